@@ -28,6 +28,16 @@ SOFTWARE. */
 #include <net-snmp/net-snmp-includes.h>
 #include <net-snmp/agent/net-snmp-agent-includes.h>
 #include <QTimer>
+#include <QSocketNotifier>
+#include <QMetaMethod>
+#include <QHash>
+#include <QThread>
+#include <QSemaphore>
+#include <QSharedPointer>
+#include <QFutureWatcher>
+#include <QPointer>
+#include <algorithm>
+#include <new>
 
 
 
@@ -82,6 +92,151 @@ QSNMPMaxAccess_e toSNMPMaxAccess(const QString & str)
     return snmpMaxAccessMap.key(str.toUpper(), QSNMPMaxAccess_Invalid);
 }
 
+/* Constructors for an OID, from a list of arcs, raw arcs or a QVector<quint32>. */
+QSNMPOid::QSNMPOid(std::initializer_list<quint32> arcs) : QSNMPOid(arcs.begin(), (int)arcs.size())
+{
+}
+QSNMPOid::QSNMPOid(const quint32 * arcs, int len) : QSNMPOid()
+{
+    this->reserve(len);
+    std::copy(arcs, arcs+len, this->data());
+    mSize = len;
+}
+QSNMPOid::QSNMPOid(const QVector<quint32> & vector) : QSNMPOid(vector.constData(), vector.size())
+{
+}
+
+/* Copy and move constructors for an OID: only OIDs stored on the heap are allocated (or moved). */
+QSNMPOid::QSNMPOid(const QSNMPOid & other) : QSNMPOid(other.constData(), other.size())
+{
+}
+QSNMPOid::QSNMPOid(QSNMPOid && other) : QSNMPOid()
+{
+    *this = std::move(other);
+}
+
+/* Destructor for an OID. */
+QSNMPOid::~QSNMPOid()
+{
+    if(mCapacity > qsnmpOidInlineArcs)
+        delete[] mHeap;
+}
+
+/* Assignment operators for an OID, reusing the current storage when large enough. */
+QSNMPOid & QSNMPOid::operator=(const QSNMPOid & other)
+{
+    if(this != &other)
+    {
+        mSize = 0;
+        this->reserve(other.size());
+        std::copy(other.constBegin(), other.constEnd(), this->data());
+        mSize = other.size();
+    }
+    return *this;
+}
+QSNMPOid & QSNMPOid::operator=(QSNMPOid && other)
+{
+    if(this == &other)
+        return *this;
+    if(other.mCapacity > qsnmpOidInlineArcs)
+    {
+        /* Steal the heap storage */
+        if(mCapacity > qsnmpOidInlineArcs)
+            delete[] mHeap;
+        mHeap = other.mHeap;
+        mCapacity = other.mCapacity;
+        mSize = other.mSize;
+        other.mCapacity = qsnmpOidInlineArcs;
+        other.mSize = 0;
+        return *this;
+    }
+    return (*this = static_cast<const QSNMPOid &>(other));
+}
+
+/* Returns the sub-OID of 'len' arcs (or up to the end if -1) starting at arc 'pos'. */
+QSNMPOid QSNMPOid::mid(int pos, int len) const
+{
+    if((pos < 0) || (pos >= mSize))
+        return QSNMPOid();
+    if((len < 0) || (pos+len > mSize))
+        len = mSize-pos;
+    return QSNMPOid(this->constData()+pos, len);
+}
+
+/* Returns true if this OID starts with the given prefix (i.e. lies under it). */
+bool QSNMPOid::startsWith(const QSNMPOid & prefix) const
+{
+    return (prefix.size() <= mSize) && std::equal(prefix.constBegin(), prefix.constEnd(), this->constData());
+}
+
+/* Returns this OID as a QVector<quint32>. */
+QVector<quint32> QSNMPOid::toVector() const
+{
+    QVector<quint32> vector(mSize);
+    std::copy(this->constBegin(), this->constEnd(), vector.data());
+    return vector;
+}
+
+/* Makes room for at least 'capacity' arcs, moving the arcs to the heap beyond qsnmpOidInlineArcs. */
+void QSNMPOid::reserve(int capacity)
+{
+    if(capacity <= mCapacity)
+        return;
+    quint32 * heap = new quint32[capacity];
+    std::copy(this->constBegin(), this->constEnd(), heap);
+    if(mCapacity > qsnmpOidInlineArcs)
+        delete[] mHeap;
+    mHeap = heap;
+    mCapacity = capacity;
+}
+
+/* Resizes this OID, new arcs are set to 0. */
+void QSNMPOid::resize(int size)
+{
+    this->reserve(size);
+    if(size > mSize)
+        std::fill(this->data()+mSize, this->data()+size, 0);
+    mSize = size;
+}
+
+/* Appends the arcs of another OID to this one. */
+void QSNMPOid::append(const QSNMPOid & other)
+{
+    int size = mSize + other.size();
+    if(size > mCapacity)
+        this->reserve(qMax(size, 2*mCapacity));
+    std::copy(other.constBegin(), other.constEnd(), this->data()+mSize);
+    mSize = size;
+}
+
+/* OID comparison operators. */
+bool QSNMPOid::operator==(const QSNMPOid & other) const
+{
+    return (mSize == other.size()) && std::equal(this->constBegin(), this->constEnd(), other.constData());
+}
+bool QSNMPOid::operator<(const QSNMPOid & other) const
+{
+    return qsnmpOidCompare(this->constData(), mSize, other.constData(), other.size()) < 0;
+}
+
+/* OID hash, for QHash keys. */
+uint qHash(const QSNMPOid & oid, uint seed)
+{
+    return qHashBits(oid.constData(), oid.size()*sizeof(quint32), seed);
+}
+
+/* OID to/from QVector<quint32> conversions for QVariant values, and meta-type registration */
+static bool initSNMPOidMetaType()
+{
+    qRegisterMetaType<QSNMPOid>("QSNMPOid");
+    if(!QMetaType::hasRegisteredConverterFunction<QVector<quint32>, QSNMPOid>())
+        QMetaType::registerConverter<QVector<quint32>, QSNMPOid>([](const QVector<quint32> & v) { return QSNMPOid(v); });
+    if(!QMetaType::hasRegisteredConverterFunction<QSNMPOid, QVector<quint32> >())
+        QMetaType::registerConverter<QSNMPOid, QVector<quint32> >(&QSNMPOid::toVector);
+    return true;
+}
+static const bool snmpOidMetaType = initSNMPOidMetaType();
+
 /* OID to string conversion */
 QString toString(const QSNMPOid & oid)
 {
@@ -91,410 +246,2389 @@ QString toString(const QSNMPOid & oid)
     return str;
 }
 
-/* Qt to/from Net-SNMP OID conversions */
-static void convertOidQtToSnmp(const QSNMPOid & qtOid, oid * snmpOid, size_t * snmpOidLen, size_t maxSnmpOidLen = 32)
+/* Qt to/from Net-SNMP OID conversions. The Net-SNMP OID buffer holds 'maxSnmpOidLen' arcs (MAX_OID_LEN,
+ * the Net-SNMP maximum, by default), OIDs that do not fit are rejected rather than truncated. */
+static bool convertOidQtToSnmp(const QSNMPOid & qtOid, oid * snmpOid, size_t * snmpOidLen, size_t maxSnmpOidLen = MAX_OID_LEN)
 {
-    size_t maxLen = qMin((size_t)qtOid.size(), maxSnmpOidLen);
-    for(size_t k=0; k<maxLen; k++)
-        snmpOid[k] = qtOid[k];
-    *snmpOidLen = maxLen;
+    *snmpOidLen = 0;
+    if((size_t)qtOid.size() > maxSnmpOidLen)
+        return false;
+    std::copy(qtOid.constBegin(), qtOid.constEnd(), snmpOid);
+    *snmpOidLen = qtOid.size();
+    return true;
 }
 static QSNMPOid convertOidSnmpToQt(oid * snmpOid, size_t snmpOidLen)
 {
     QSNMPOid qtOid;
     if(snmpOid)
     {
+        qtOid.reserve((int)snmpOidLen);
         for(size_t k=0; k<snmpOidLen; k++)
             qtOid << snmpOid[k];
     }
     return qtOid;
 }
 
+/* Returns true if a bound value type matches a SNMP data type. */
+static bool isBindingCompatible(QSNMPType_e type, QSNMPBinding_e binding)
+{
+    switch(type)
+    {
+    case QSNMPType_Integer:
+        return (binding == QSNMPBinding_Int32) || (binding == QSNMPBinding_AtomicInt32);
+    case QSNMPType_TimeTicks:
+    case QSNMPType_Gauge:
+    case QSNMPType_Counter:
+    case QSNMPType_IpAddress:
+        return (binding == QSNMPBinding_UInt32) || (binding == QSNMPBinding_AtomicUInt32);
+    case QSNMPType_Counter64:
+        return (binding == QSNMPBinding_UInt64) || (binding == QSNMPBinding_AtomicUInt64);
+    default:
+        return false;
+    }
+}
+
+/* Bound values readers, return false if the variable is not bound to a value of that type. */
+static bool readBoundValue(const QSNMPVar * var, qint32 & value)
+{
+    switch(var->binding())
+    {
+    case QSNMPBinding_Int32:
+        value = *static_cast<const qint32 *>(var->boundValue());
+        return true;
+    case QSNMPBinding_AtomicInt32:
+        value = static_cast<const std::atomic<qint32> *>(var->boundValue())->load(std::memory_order_relaxed);
+        return true;
+    default:
+        return false;
+    }
+}
+static bool readBoundValue(const QSNMPVar * var, quint32 & value)
+{
+    switch(var->binding())
+    {
+    case QSNMPBinding_UInt32:
+        value = *static_cast<const quint32 *>(var->boundValue());
+        return true;
+    case QSNMPBinding_AtomicUInt32:
+        value = static_cast<const std::atomic<quint32> *>(var->boundValue())->load(std::memory_order_relaxed);
+        return true;
+    default:
+        return false;
+    }
+}
+static bool readBoundValue(const QSNMPVar * var, quint64 & value)
+{
+    switch(var->binding())
+    {
+    case QSNMPBinding_UInt64:
+        value = *static_cast<const quint64 *>(var->boundValue());
+        return true;
+    case QSNMPBinding_AtomicUInt64:
+        value = static_cast<const std::atomic<quint64> *>(var->boundValue())->load(std::memory_order_relaxed);
+        return true;
+    default:
+        return false;
+    }
+}
+
 
 
-/******************************************************************/
-/******************** VARIABLE GET/SET HANDLER ********************/
-/******************************************************************/
+/***********************************************************/
+/******************** SNMP VARIABLE MAP ********************/
+/***********************************************************/
 
-/* Net-SNMP request callback, forward to QSNMPAgent handler. */
-static int variableHandler(netsnmp_mib_handler * handler, netsnmp_handler_registration * reginfo,
-                            netsnmp_agent_request_info * reqinfo, netsnmp_request_info * requests)
+/* Monotonic clock of the value cache and trap queue, in milliseconds */
+static qint64 clockMs()
 {
-    /* Call agent handler */
-    QSNMPAgent * agent = static_cast<QSNMPAgent*>(reginfo->my_reg_void);
-    if(!agent)
-        return SNMP_ERR_GENERR;
-    return agent->handler(handler, reginfo, reqinfo, requests);
+    QElapsedTimer timer;
+    timer.start();
+    return timer.msecsSinceReference();
 }
 
+/* Variable versus variable ordering */
+bool QSNMPVarOidLess::operator()(const QSNMPVar * a, const QSNMPVar * b) const
+{
+    return a->compare(b) < 0;
+}
 
+/* Returns the OID of the variable pointed to by this iterator. */
+QSNMPOid QSNMPVarMap::const_iterator::key() const
+{
+    return (*mIt)->oid();
+}
 
-/****************************************************/
-/******************** SNMP AGENT ********************/
-/****************************************************/
+/* Returns the number of variables in the map. */
+int QSNMPVarMap::size() const
+{
+    return (int)mIndex.size();
+}
 
-/* SNMP agent constructor, initializes Net-SNMP library as AgentX sub-agent. */
-QSNMPAgent::QSNMPAgent(const QString & agentName, const QString & agentAddr)
+/* Returns true if the map contains no variable. */
+bool QSNMPVarMap::isEmpty() const
 {
-    /* Initialize member variables */
-    mAgentName = agentName;
-    mVarMap.clear();
-    mTimer.start();
-    mTrapsEnabled = true;
+    return mIndex.empty();
+}
 
-    /* Initialize agentX/SNMP libraries */
-    netsnmp_ds_set_boolean(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_ROLE, 1);
-    if(!mAgentName.isEmpty())
-        netsnmp_ds_set_string(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_X_SOCKET, agentAddr.toStdString().c_str());
-    init_agent(mAgentName.toStdString().c_str());
-    init_snmp(mAgentName.toStdString().c_str());
+/* Returns true if a variable with the given OID is in the map. */
+bool QSNMPVarMap::contains(const QSNMPOid & oid) const
+{
+    return this->find(oid.constData(), oid.size()) != nullptr;
+}
 
-    /* Initial event processing start */
-    QTimer::singleShot(0, this, SLOT(processEvents()));
+/* Returns the variable with the given OID, or nullptr if none found. */
+QSNMPVar * QSNMPVarMap::value(const QSNMPOid & oid) const
+{
+    return this->find(oid.constData(), oid.size());
 }
 
-/* SNMP agent destructor, shutdowns Net-SNMP library. */
-QSNMPAgent::~QSNMPAgent()
+/* Returns the list of variables in the map, in OID order. */
+QSNMPVarList QSNMPVarMap::values() const
 {
-    snmp_shutdown(mAgentName.toStdString().c_str());
-    shutdown_agent();
+    QSNMPVarList list;
+    list.reserve((int)mIndex.size());
+    for(Index::const_iterator it = mIndex.begin(); it != mIndex.end(); ++it)
+        list << *it;
+    return list;
 }
 
-/* Returns the map of SNMP variables managed by this agent. */
-const QSNMPVarMap & QSNMPAgent::varMap() const
+/* Iteration over the variables, in OID order. */
+QSNMPVarMap::const_iterator QSNMPVarMap::begin() const
 {
-    return mVarMap;
+    return const_iterator(mIndex.begin());
+}
+QSNMPVarMap::const_iterator QSNMPVarMap::end() const
+{
+    return const_iterator(mIndex.end());
+}
+QSNMPVarMap::const_iterator QSNMPVarMap::constBegin() const
+{
+    return const_iterator(mIndex.begin());
+}
+QSNMPVarMap::const_iterator QSNMPVarMap::constEnd() const
+{
+    return const_iterator(mIndex.end());
 }
 
-/* Registers a SNMP variable to this agent.
- * This function is called by the QSNMPModule snmpCreateVar function and
- * should typically not be called directly by the user application.
- * Returns true on success, or false on failure. */
-bool QSNMPAgent::registerVar(QSNMPVar * var)
+/* Inserts a variable in the map. Returns false if a variable with the same OID is already present. */
+bool QSNMPVarMap::insert(QSNMPVar * var)
 {
-    /* Check if already registered */
-    if(mVarMap.contains(var->oidString()))
-    {
-        emit this->newLog(QSNMPLogType_RegisterFail,
-                          QString("Could not register SNMP variable %1: already registered").arg(var->fullName()));
+    return mIndex.insert(var).second;
+}
+
+/* Removes a variable from the map. Returns false if that variable is not in the map. */
+bool QSNMPVarMap::remove(QSNMPVar * var)
+{
+    Index::iterator it = mIndex.find(var);
+    if((it == mIndex.end()) || (*it != var))
         return false;
-    }
+    mIndex.erase(it);
+    return true;
+}
 
-    /* Notify variables are not actually registered with the Net-SNMP library */
-    if(var->maxAccess() != QSNMPMaxAccess_Notify)
-    {
-        /* Create handler registration */
-        var->setRegistration(nullptr);
-        QVector<oid> oidVector;
-        foreach(quint32 k, var->oid())
-            oidVector << k;
-        netsnmp_handler_registration * reginfo = netsnmp_create_handler_registration(var->name().toStdString().c_str(),
-                                                                                     variableHandler,
-                                                                                     (const oid *)oidVector.constData(),
-                                                                                     oidVector.size(),
-                                                                                     (var->maxAccess()==QSNMPMaxAccess_ReadWrite)?HANDLER_CAN_RWRITE:HANDLER_CAN_RONLY);
-        if(!reginfo)
-        {
-            emit this->newLog(QSNMPLogType_RegisterFail,
-                              QString("Could not register SNMP variable %1: handler creation failed").arg(var->fullName()));
-            return false;
-        }
+/* Removes all variables from the map. */
+void QSNMPVarMap::clear()
+{
+    mIndex.clear();
+}
 
-        /* Our context data */
-        reginfo->my_reg_void = this;
 
-        /* Register instance */
-        int rc = netsnmp_register_instance(reginfo);
-        if(rc == MIB_REGISTRATION_FAILED)
-        {
-            netsnmp_handler_registration_free(reginfo);
-            emit this->newLog(QSNMPLogType_RegisterFail,
-                              QString("Could not register SNMP variable %1: handler registration failed").arg(var->fullName()));
-            return false;
-        }
-        else if(rc == MIB_DUPLICATE_REGISTRATION)
-        {
-            netsnmp_handler_registration_free(reginfo);
-            emit this->newLog(QSNMPLogType_RegisterFail,
-                              QString("Could not register SNMP variable %1: duplicate handler registration").arg(var->fullName()));
-            return false;
-        }
-        var->setRegistration(reginfo);
-    }
 
-    /* Done, add to map */
-    mVarMap.insert(var->oidString(), var);
-    emit this->newLog(QSNMPLogType_RegisterOK,
-                      QString("Registered SNMP variable %1").arg(var->fullName()));
-    return true;
+/***********************************************************/
+/******************** SNMP MEMORY POOL *********************/
+/***********************************************************/
+
+/* Number of objects of the first chunk allocated by a pool, the following chunks being twice
+ * as large as the previous one up to the maximum */
+static const int poolMinChunk = 16;
+static const int poolMaxChunk = 4096;
+
+/* Constructor for a memory pool of objects of the given size, no memory is allocated until needed. */
+QSNMPPool::QSNMPPool(size_t objectSize)
+{
+    /* Slots are large enough for the free list link, and aligned for any object */
+    const size_t align = alignof(std::max_align_t);
+    mSlotSize = (qMax(objectSize, sizeof(void *)) + align - 1) / align * align;
+    mSize = 0;
+    mCapacity = 0;
+    mFreeList = nullptr;
 }
 
-/* Unregisters a SNMP variable from this agent.
- * This function is called by the QSNMPModule snmpDeleteVar function and
- * should typically not be called directly by the user application. */
-void QSNMPAgent::unregisterVar(QSNMPVar * var)
+/* Destructor for a memory pool, frees all chunks: the objects must have been destroyed beforehand. */
+QSNMPPool::~QSNMPPool()
 {
-    if(mVarMap.contains(var->oidString()))
-    {
-        /* Notify variables are not actually registered with the Net-SNMP library */
-        emit this->newLog(QSNMPLogType_UnregisterOK,
-                          QString("Unregistered SNMP variable %1").arg(var->fullName()));
-        if(var->maxAccess() != QSNMPMaxAccess_Notify)
-        {
-            /* Unregister variable and remove from map */
-            netsnmp_unregister_handler((netsnmp_handler_registration *)var->registration());
-            var->setRegistration(nullptr);
-            mVarMap.remove(var->oidString());
-        }
-    }
-    else
-        emit this->newLog(QSNMPLogType_UnregisterFail,
-                          QString("Could not unregister SNMP variable %1: not registered").arg(var->fullName()));
+    foreach(char * chunk, mChunks)
+        ::operator delete(chunk);
 }
 
-/* The main variable GET/SET callback handler, called by the Net-SNMP library on GET/SET messages.
- * Note that here we use the same callback for all variables, so that implementation-specific
- * behavior is determined outside of the QSNMP context. */
-int QSNMPAgent::handler(void * _handler, void * _reginfo, void * _reqinfo, void * _requests)
+/* Returns the size of the slots of this pool. */
+size_t QSNMPPool::objectSize() const
 {
-    Q_UNUSED(_handler)
-    Q_UNUSED(_reginfo)
-    netsnmp_agent_request_info * reqinfo = (netsnmp_agent_request_info * )_reqinfo;
-    netsnmp_request_info * requests = (netsnmp_request_info * )_requests;
+    return mSlotSize;
+}
 
-    /* Variables list */
-    netsnmp_variable_list * netsnmp_varlist = requests->requestvb;
+/* Returns the number of allocated objects. */
+int QSNMPPool::size() const
+{
+    QMutexLocker locker(&mLock);
+    return mSize;
+}
 
-    /* Action */
-    if((reqinfo->mode == MODE_GET) || (reqinfo->mode == MODE_GETNEXT))
+/* Returns the number of objects that can be allocated without allocating a new chunk. */
+int QSNMPPool::capacity() const
+{
+    QMutexLocker locker(&mLock);
+    return mCapacity;
+}
+
+/* Returns storage for a new object (to be constructed with placement new). */
+void * QSNMPPool::allocate()
+{
+    QMutexLocker locker(&mLock);
+    if(!mFreeList)
     {
-        /* Multiple variables supported for GET requests */
-        while(netsnmp_varlist)
+        /* Allocate a new chunk, and thread its slots into the free list */
+        int count = mChunks.isEmpty() ? poolMinChunk : qMin(mCapacity, poolMaxChunk);
+        char * chunk = static_cast<char *>(::operator new(mSlotSize * count));
+        mChunks << chunk;
+        mCapacity += count;
+        for(int k=count-1; k>=0; k--)
         {
-            /* Get the corresponding variable from agent */
-            QSNMPOid qtOid = convertOidSnmpToQt(netsnmp_varlist->name, netsnmp_varlist->name_length);
-            QSNMPVar * var = mVarMap.value(toString(qtOid), nullptr);
-            if(!var)
-                return SNMP_ERR_GENERR;
+            void * slot = chunk + k*mSlotSize;
+            *static_cast<void **>(slot) = mFreeList;
+            mFreeList = slot;
+        }
+    }
+    void * slot = mFreeList;
+    mFreeList = *static_cast<void **>(slot);
+    mSize++;
+    return slot;
+}
 
-            /* Check access, should not be needed because the Net-SNMP library will do it for us, but still... */
-            if(var->maxAccess() < QSNMPMaxAccess_ReadOnly)
-                return SNMP_ERR_GENERR;
+/* Gives back the storage of an object (already destroyed) to the pool. */
+void QSNMPPool::release(void * object)
+{
+    if(!object)
+        return;
+    QMutexLocker locker(&mLock);
+    *static_cast<void **>(object) = mFreeList;
+    mFreeList = object;
+    mSize--;
+}
 
-            /* Read value from user application */
-            QVariant v = var->get();
-            emit this->newLog(QSNMPLogType_GET,
-                              QString("SNMP-GET: %1 [%2] : %4 = %5").arg(var->fullName())
-                                                                    .arg(toString(var->maxAccess()))
-                                                                    .arg(toString(var->type()))
-                                                                    .arg(v.toString()));
 
-            /* Convert from Qt to SNMP data */
-            switch(var->type())
-            {
-            case QSNMPType_Integer: /* qint32 */
-            {
-                qint32 value = v.value<qint32>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_INTEGER, &value, 4);
-                break;
-            }
-            case QSNMPType_OctetStr: /* QString */
-            {
-                QByteArray byteArray = v.value<QString>().toUtf8();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_OCTET_STR, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_BitStr: /* QString */
-            {
-                QByteArray byteArray = v.value<QString>().toUtf8();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_BIT_STR, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_Opaque: /* QByteArray */
-            {
-                QByteArray byteArray = v.value<QByteArray>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_OPAQUE, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_ObjectId: /* QSNMPOid */
-            {
-                QSNMPOid qtOid = v.value<QSNMPOid>();
-                oid snmpOid[32];
-                size_t snmpOidLen;
-                convertOidQtToSnmp(qtOid, snmpOid, &snmpOidLen, 32);
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_OBJECT_ID, snmpOid, snmpOidLen*sizeof(oid));
-                break;
-            }
-            case QSNMPType_TimeTicks: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_TIMETICKS, &value, 4);
-                break;
-            }
-            case QSNMPType_Gauge: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_GAUGE, &value, 4);
-                break;
-            }
-            case QSNMPType_Counter: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_COUNTER, &value, 4);
-                break;
-            }
-            case QSNMPType_IpAddress: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                quint8 ip[4];
-                ip[0] = (value >> 24) & 0xFF;
-                ip[1] = (value >> 16) & 0xFF;
-                ip[2] = (value >> 8) & 0xFF;
-                ip[3] = (value >> 0) & 0xFF;
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_IPADDRESS, ip, 4);
-                break;
-            }
-            case QSNMPType_Counter64: /* quint64 */
-            {
-                quint64 value = v.value<quint64>();
-                snmp_set_var_typed_value(netsnmp_varlist, ASN_COUNTER64, &value, 8);
-                break;
-            }
-            case QSNMPType_Null:
-                return SNMP_ERR_GENERR;
-            default:
-                return SNMP_ERR_GENERR;
-            }
 
-            /* Next variable */
-            netsnmp_varlist = netsnmp_varlist->next_variable;
-        }
+/******************************************************************/
+/******************** VARIABLE GET/SET HANDLER ********************/
+/******************************************************************/
+
+/* Converts a Net-SNMP variable binding value from SNMP to Qt data, according to the given data type.
+ * Returns SNMP_ERR_NOERROR on success, or the SNMP error to respond with. */
+static int readVarbindValue(QSNMPType_e type, const netsnmp_variable_list * varbind, QVariant & v)
+{
+    switch(type)
+    {
+    case QSNMPType_Integer: /* qint32 */
+    {
+        if(varbind->type != ASN_INTEGER)
+            return SNMP_ERR_WRONGTYPE;
+        qint32 value = *((qint32*)varbind->val.integer);
+        v.setValue<qint32>(value);
+        break;
     }
-    else if(reqinfo->mode == MODE_SET_ACTION)
+    case QSNMPType_OctetStr: /* QString */
     {
-        /* Only single variable supported for SET requests */
-        if(netsnmp_varlist->next_variable)
-            return SNMP_ERR_GENERR;
-
-        /* Get the corresponding variable from agent */
-        QSNMPOid qtOid = convertOidSnmpToQt(netsnmp_varlist->name, netsnmp_varlist->name_length);
-        QSNMPVar * var = mVarMap.value(toString(qtOid), nullptr);
-        if(!var)
-            return SNMP_ERR_GENERR;
-
-        /* Check access, should not be needed because the Net-SNMP library will do it for us, but still... */
-        if(var->maxAccess() < QSNMPMaxAccess_ReadWrite)
-            return SNMP_ERR_GENERR;
-
-        /* Convert from SNMP to Qt data */
-        QVariant v;
-        bool validType = true;
-        switch(var->type())
-        {
-        case QSNMPType_Integer: /* qint32 */
-        {
-            if(netsnmp_varlist->type != ASN_INTEGER)
-                validType = false;
-            qint32 value = *((qint32*)netsnmp_varlist->val.integer);
-            v.setValue<qint32>(value);
-            break;
-        }
-        case QSNMPType_OctetStr: /* QString */
-        {
-            if(netsnmp_varlist->type != ASN_OCTET_STR)
-                validType = false;
-            QString str = QString(QByteArray((const char*)netsnmp_varlist->val.string, netsnmp_varlist->val_len));
-            v.setValue<QString>(str);
-            break;
-        }
-        case QSNMPType_BitStr: /* QString */
-        {
-            if(netsnmp_varlist->type != ASN_BIT_STR)
-                validType = false;
-            QString str = QString(QByteArray((const char*)netsnmp_varlist->val.bitstring, netsnmp_varlist->val_len));
-            v.setValue<QString>(str);
-            break;
+        if(varbind->type != ASN_OCTET_STR)
+            return SNMP_ERR_WRONGTYPE;
+        QString str = QString(QByteArray((const char*)varbind->val.string, varbind->val_len));
+        v.setValue<QString>(str);
+        break;
+    }
+    case QSNMPType_BitStr: /* QString */
+    {
+        if(varbind->type != ASN_BIT_STR)
+            return SNMP_ERR_WRONGTYPE;
+        QString str = QString(QByteArray((const char*)varbind->val.bitstring, varbind->val_len));
+        v.setValue<QString>(str);
+        break;
+    }
+    case QSNMPType_Opaque: /* QByteArray */
+    {
+        if(varbind->type != ASN_OPAQUE)
+            return SNMP_ERR_WRONGTYPE;
+        QByteArray ba = QByteArray((const char*)varbind->val.string, varbind->val_len);
+        v.setValue<QByteArray>(ba);
+        break;
+    }
+    case QSNMPType_ObjectId: /* QSNMPOid */
+    {
+        if(varbind->type != ASN_OBJECT_ID)
+            return SNMP_ERR_WRONGTYPE;
+        QSNMPOid qtOid = convertOidSnmpToQt(varbind->val.objid, varbind->val_len/sizeof(oid));
+        v.setValue<QSNMPOid>(qtOid);
+        break;
+    }
+    case QSNMPType_TimeTicks: /* quint32 */
+    {
+        if(varbind->type != ASN_TIMETICKS)
+            return SNMP_ERR_WRONGTYPE;
+        quint32 value = *((quint32*)varbind->val.integer);
+        v.setValue<quint32>(value);
+        break;
+    }
+    case QSNMPType_Gauge: /* quint32 */
+    {
+        if(varbind->type != ASN_GAUGE)
+            return SNMP_ERR_WRONGTYPE;
+        quint32 value = *((quint32*)varbind->val.integer);
+        v.setValue<quint32>(value);
+        break;
+    }
+    case QSNMPType_Counter: /* quint32 */
+    {
+        if(varbind->type != ASN_COUNTER)
+            return SNMP_ERR_WRONGTYPE;
+        quint32 value = *((quint32*)varbind->val.integer);
+        v.setValue<quint32>(value);
+        break;
+    }
+    case QSNMPType_IpAddress: /* quint32 */
+    {
+        if(varbind->type != ASN_IPADDRESS)
+            return SNMP_ERR_WRONGTYPE;
+        quint8 * ip = varbind->val.string;
+        quint32 value = ((quint32)ip[0] << 24) | ((quint32)ip[1] << 16) | ((quint32)ip[2] << 8) | ((quint32)ip[3] << 0);
+        v.setValue<quint32>(value);
+        break;
+    }
+    case QSNMPType_Counter64: /* quint64 */
+    {
+        if(varbind->type != ASN_COUNTER64)
+            return SNMP_ERR_WRONGTYPE;
+        quint64 value = ((quint64)varbind->val.counter64->high << 32) | (quint64)varbind->val.counter64->low;
+        v.setValue<quint64>(value);
+        break;
+    }
+    case QSNMPType_Null:
+        return SNMP_ERR_GENERR;
+    default:
+        return SNMP_ERR_GENERR;
+    }
+    return SNMP_ERR_NOERROR;
+}
+
+/* A GET request waiting for its value from the user application. The variable is only used
+ * for modules called directly, the others look it up again from the request OID. The module is only
+ * used if it still has the same generation (see QSNMPAgent::addModule) once the map is locked again. */
+struct QSNMPAgent::PendingGet
+{
+    netsnmp_request_info *      request;
+    QSNMPVar *                  var;
+    QSNMPModule *               module;
+    quint64                     generation;
+    QObject *                   context;
+    quint32                     cacheGeneration;
+};
+
+/* A module callback posted to the module's thread, which can be cancelled until it starts running */
+typedef struct
+{
+    QAtomicInt                  state;  // 0: pending, 1: running, -1: cancelled
+    QSemaphore                  done;
+} ModuleCall;
+
+/* Maximum time to wait for a module's thread, after that the master agent has timed out anyway
+ * (AgentX default timeout) and the request is failed rather than blocking the agent thread. */
+static const int moduleCallTimeoutMs = 1000;
+
+/* Returns the object through which a module (or table) with the given call context must be called from
+ * the current (agent) thread, or nullptr if it can be called directly. */
+static QObject * callContext(QObject * context)
+{
+    if(!context || (context->thread() == QThread::currentThread()))
+        return nullptr;
+    return context;
+}
+
+/* Net-SNMP request callback, forward to QSNMPAgent handler. */
+static int variableHandler(netsnmp_mib_handler * handler, netsnmp_handler_registration * reginfo,
+                            netsnmp_agent_request_info * reqinfo, netsnmp_request_info * requests)
+{
+    /* Call agent handler */
+    QSNMPAgent * agent = static_cast<QSNMPAgent*>(reginfo->my_reg_void);
+    if(!agent)
+        return SNMP_ERR_GENERR;
+    return agent->handler(handler, reginfo, reqinfo, requests);
+}
+
+/* Calls a module's get callbacks through 'read', and records the time spent in the module's statistics
+ * if 'timed' (see QSNMPAgent::setStatisticsEnabled). */
+template<typename F> static bool timedRead(QSNMPModule * module, bool timed, const F & read)
+{
+    if(!timed)
+        return read();
+    QElapsedTimer timer;
+    timer.start();
+    bool ok = read();
+    module->snmpRecordGet(timer.nsecsElapsed());
+    return ok;
+}
+
+/* Creates and registers a Net-SNMP handler for the given OID, either as a single instance
+ * or as a whole subtree. A non-zero 'rangeUbound' registers the subtrees of all OIDs from the given one
+ * up to that value of the last arc (range registration). Returns the registration, or nullptr on failure
+ * in which case 'error' is set to the failure reason. */
+static netsnmp_handler_registration * registerHandler(QSNMPAgent * agent, const QString & name, const QSNMPOid & qtOid,
+                                                      bool readWrite, bool instance, quint32 rangeUbound, QString * error)
+{
+    /* Create handler registration */
+    oid snmpOid[MAX_OID_LEN];
+    size_t snmpOidLen;
+    if(!convertOidQtToSnmp(qtOid, snmpOid, &snmpOidLen))
+    {
+        *error = QString("OID longer than %1 arcs").arg(MAX_OID_LEN);
+        return nullptr;
+    }
+    netsnmp_handler_registration * reginfo = netsnmp_create_handler_registration(name.toStdString().c_str(),
+                                                                                 variableHandler,
+                                                                                 snmpOid,
+                                                                                 snmpOidLen,
+                                                                                 readWrite?HANDLER_CAN_RWRITE:HANDLER_CAN_RONLY);
+    if(!reginfo)
+    {
+        *error = "handler creation failed";
+        return nullptr;
+    }
+
+    /* Our context data */
+    reginfo->my_reg_void = agent;
+
+    /* Range of the last arc */
+    if(rangeUbound)
+    {
+        reginfo->range_subid = snmpOidLen;
+        reginfo->range_ubound = rangeUbound;
+    }
+
+    /* Register instance or subtree */
+    int rc = instance ? netsnmp_register_instance(reginfo) : netsnmp_register_handler(reginfo);
+    if(rc == MIB_REGISTRATION_FAILED)
+    {
+        netsnmp_handler_registration_free(reginfo);
+        *error = "handler registration failed";
+        return nullptr;
+    }
+    else if(rc == MIB_DUPLICATE_REGISTRATION)
+    {
+        netsnmp_handler_registration_free(reginfo);
+        *error = "duplicate handler registration";
+        return nullptr;
+    }
+    return reginfo;
+}
+
+/* Writes an unsigned 32/64-bit value into a Net-SNMP variable binding, with the given data type. */
+static void writeVarValue(QSNMPType_e type, netsnmp_variable_list * varbind, quint32 value)
+{
+    switch(type)
+    {
+    case QSNMPType_TimeTicks:
+        snmp_set_var_typed_value(varbind, ASN_TIMETICKS, &value, 4);
+        break;
+    case QSNMPType_Gauge:
+        snmp_set_var_typed_value(varbind, ASN_GAUGE, &value, 4);
+        break;
+    case QSNMPType_Counter:
+        snmp_set_var_typed_value(varbind, ASN_COUNTER, &value, 4);
+        break;
+    case QSNMPType_IpAddress:
+    {
+        quint8 ip[4];
+        ip[0] = (value >> 24) & 0xFF;
+        ip[1] = (value >> 16) & 0xFF;
+        ip[2] = (value >> 8) & 0xFF;
+        ip[3] = (value >> 0) & 0xFF;
+        snmp_set_var_typed_value(varbind, ASN_IPADDRESS, ip, 4);
+        break;
+    }
+    default:
+        break;
+    }
+}
+static void writeVarValue(QSNMPType_e type, netsnmp_variable_list * varbind, quint64 value)
+{
+    Q_UNUSED(type)
+    struct counter64 c64;
+    c64.high = (u_long)(value >> 32);
+    c64.low = (u_long)(value & 0xFFFFFFFF);
+    snmp_set_var_typed_value(varbind, ASN_COUNTER64, &c64, sizeof(c64));
+}
+
+/* Converts a value of the given data type from Qt to SNMP data, and writes it into a Net-SNMP variable binding.
+ * Returns false if the data type is not supported. */
+static bool writeVarValue(QSNMPType_e type, netsnmp_variable_list * varbind, const QVariant & v)
+{
+    switch(type)
+    {
+    case QSNMPType_Integer: /* qint32 */
+    {
+        qint32 value = v.value<qint32>();
+        snmp_set_var_typed_value(varbind, ASN_INTEGER, &value, 4);
+        break;
+    }
+    case QSNMPType_OctetStr: /* QString */
+    {
+        QByteArray byteArray = v.value<QString>().toUtf8();
+        snmp_set_var_typed_value(varbind, ASN_OCTET_STR, byteArray.constData(), byteArray.size());
+        break;
+    }
+    case QSNMPType_BitStr: /* QString */
+    {
+        QByteArray byteArray = v.value<QString>().toUtf8();
+        snmp_set_var_typed_value(varbind, ASN_BIT_STR, byteArray.constData(), byteArray.size());
+        break;
+    }
+    case QSNMPType_Opaque: /* QByteArray */
+    {
+        QByteArray byteArray = v.value<QByteArray>();
+        snmp_set_var_typed_value(varbind, ASN_OPAQUE, byteArray.constData(), byteArray.size());
+        break;
+    }
+    case QSNMPType_ObjectId: /* QSNMPOid */
+    {
+        QSNMPOid qtOid = v.value<QSNMPOid>();
+        oid snmpOid[MAX_OID_LEN];
+        size_t snmpOidLen;
+        if(!convertOidQtToSnmp(qtOid, snmpOid, &snmpOidLen))
+            return false;
+        snmp_set_var_typed_value(varbind, ASN_OBJECT_ID, snmpOid, snmpOidLen*sizeof(oid));
+        break;
+    }
+    case QSNMPType_TimeTicks: /* quint32 */
+    case QSNMPType_Gauge: /* quint32 */
+    case QSNMPType_Counter: /* quint32 */
+    case QSNMPType_IpAddress: /* quint32 */
+        writeVarValue(type, varbind, v.value<quint32>());
+        break;
+    case QSNMPType_Counter64: /* quint64 */
+        writeVarValue(type, varbind, v.value<quint64>());
+        break;
+    case QSNMPType_Null:
+        return false;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Size of the stack buffer handed over to QSNMPModule::snmpGetBytes */
+static const size_t bytesBufferSize = 1024;
+
+/* Reads a variable's value straight from its bound application value or the module's typed getters,
+ * and writes it into a Net-SNMP variable binding without any intermediate heap object.
+ * If 'log' is set, it also receives the value as a QVariant for logging purposes.
+ * Returns false if no such direct value is available, in which case the QVariant getter must be used. */
+static bool readVarValueDirect(const QSNMPVar * var, netsnmp_variable_list * varbind, QVariant * log)
+{
+    QSNMPModule * module = var->module();
+    switch(var->type())
+    {
+    case QSNMPType_Integer: /* qint32 */
+    {
+        qint32 value;
+        if(!readBoundValue(var, value) && !module->snmpGetInt32(var, value))
+            return false;
+        snmp_set_var_typed_value(varbind, ASN_INTEGER, &value, 4);
+        if(log)
+            log->setValue<qint32>(value);
+        return true;
+    }
+    case QSNMPType_OctetStr: /* QString */
+    case QSNMPType_BitStr: /* QString */
+    {
+        char buf[bytesBufferSize];
+        int len = module->snmpGetBytes(var, buf, sizeof(buf));
+        if(len < 0)
+            return false;
+        snmp_set_var_typed_value(varbind, (var->type() == QSNMPType_OctetStr) ? ASN_OCTET_STR : ASN_BIT_STR, buf, len);
+        if(log)
+            log->setValue<QString>(QString::fromUtf8(buf, len));
+        return true;
+    }
+    case QSNMPType_Opaque: /* QByteArray */
+    {
+        char buf[bytesBufferSize];
+        int len = module->snmpGetBytes(var, buf, sizeof(buf));
+        if(len < 0)
+            return false;
+        snmp_set_var_typed_value(varbind, ASN_OPAQUE, buf, len);
+        if(log)
+            log->setValue<QByteArray>(QByteArray(buf, len));
+        return true;
+    }
+    case QSNMPType_TimeTicks: /* quint32 */
+    case QSNMPType_Gauge: /* quint32 */
+    case QSNMPType_Counter: /* quint32 */
+    case QSNMPType_IpAddress: /* quint32 */
+    {
+        quint32 value;
+        if(!readBoundValue(var, value) && !module->snmpGetUInt32(var, value))
+            return false;
+        writeVarValue(var->type(), varbind, value);
+        if(log)
+            log->setValue<quint32>(value);
+        return true;
+    }
+    case QSNMPType_Counter64: /* quint64 */
+    {
+        quint64 value;
+        if(!readBoundValue(var, value) && !module->snmpGetUInt64(var, value))
+            return false;
+        writeVarValue(var->type(), varbind, value);
+        if(log)
+            log->setValue<quint64>(value);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+/* Reads a variable's value from the user application and writes it into a Net-SNMP variable binding.
+ * Direct values are tried first (see readVarValueDirect), then the QVariant getter.
+ * If 'log' is set, it also receives the value as a QVariant for logging purposes.
+ * Returns false if the variable's data type is not supported. */
+static bool readVarValue(const QSNMPVar * var, netsnmp_variable_list * varbind, QVariant * log)
+{
+    if(readVarValueDirect(var, varbind, log))
+        return true;
+    QVariant v = var->get();
+    if(log)
+        *log = v;
+    return writeVarValue(var->type(), varbind, v);
+}
+
+/* Writes a variable's cached value (see QSNMPModule::snmpSetCacheTtl) into a Net-SNMP variable binding.
+ * If 'log' is set, it also receives the value as a QVariant for logging purposes.
+ * Returns false if no valid cached value is available. */
+static bool readCachedValue(const QSNMPVar * var, netsnmp_variable_list * varbind, QVariant * log)
+{
+    quint8 asnType;
+    QByteArray value;
+    if(!var->cachedValue(asnType, value))
+        return false;
+    snmp_set_var_typed_value(varbind, asnType, value.constData(), value.size());
+    if(log)
+        readVarbindValue(var->type(), varbind, *log);
+    return true;
+}
+
+/* Keeps the value written into a Net-SNMP variable binding in the variable's cache, if enabled and unless the
+ * variable was invalidated since 'generation' was taken (see QSNMPVar::cacheGeneration), before the value was read. */
+static void cacheVarValue(QSNMPVar * var, const netsnmp_variable_list * varbind, quint32 generation)
+{
+    var->setCachedValue(varbind->type, varbind->val.string, varbind->val_len, generation);
+}
+
+/* Builds the variable bindings of a trap (snmpTrapOID.0 then the variables), reading the variables'
+ * values from the user application. If 'logValues' is set, it also receives the values as QVariants
+ * for logging purposes. The returned list must be freed with snmp_free_varbind, it is nullptr if
+ * the trap OID is too long. */
+static netsnmp_variable_list * buildTrapVarbinds(const QSNMPOid & trapOid, const QSNMPVarList & varList, QVector<QVariant> * logValues)
+{
+    netsnmp_variable_list * snmpVarList = nullptr;
+
+    /* snmpTrapOID.0 */
+    static oid snmpTrapOid[] = { 1, 3, 6, 1, 6, 3, 1, 1, 4, 1, 0 };
+    oid trapOidBuf[MAX_OID_LEN];
+    size_t trapOidLen;
+    if(!convertOidQtToSnmp(trapOid, trapOidBuf, &trapOidLen))
+        return nullptr;
+    snmp_varlist_add_variable(&snmpVarList, snmpTrapOid, sizeof(snmpTrapOid)/sizeof(oid),
+                              ASN_OBJECT_ID, trapOidBuf, trapOidLen*sizeof(oid));
+
+    /* Variables bindings */
+    foreach(QSNMPVar * var, varList)
+    {
+        if(var)
+        {
+            /* Null variables cannot be bound */
+            if(var->type() >= QSNMPType_Null)
+                continue;
+
+            /* Variable OID, its length was checked when registered */
+            oid varOid[MAX_OID_LEN];
+            size_t varOidLen;
+            if(!convertOidQtToSnmp(var->oid(), varOid, &varOidLen))
+                continue;
+
+            /* Read value from user application, and convert from Qt to SNMP data */
+            QVariant v;
+            netsnmp_variable_list * varbind = snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen, ASN_NULL, nullptr, 0);
+            if(varbind)
+                readVarValue(var, varbind, logValues ? &v : nullptr);
+            if(logValues)
+                *logValues << v;
+        }
+    }
+    return snmpVarList;
+}
+
+/* Returns true if an OID lies under a registration's root OID or, for a range registration,
+ * under one of the root OIDs of the range. */
+static bool isUnderRegistration(const QSNMPOid & qtOid, const netsnmp_handler_registration * reginfo)
+{
+    if((size_t)qtOid.size() < reginfo->rootoid_len)
+        return false;
+    if(!reginfo->range_subid)
+        return (qsnmpOidCompare(qtOid.constData(), reginfo->rootoid_len, reginfo->rootoid, reginfo->rootoid_len) == 0);
+    for(size_t k=0; k<reginfo->rootoid_len; k++)
+    {
+        if(k == (size_t)(reginfo->range_subid-1))
+        {
+            if((qtOid[k] < reginfo->rootoid[k]) || (qtOid[k] > reginfo->range_ubound))
+                return false;
+        }
+        else if(qtOid[k] != reginfo->rootoid[k])
+            return false;
+    }
+    return true;
+}
+
+/* Resolves a GETNEXT request against the variable map: returns the first readable variable
+ * following the requested OID (or equal to it if 'inclusive') that still lies under the
+ * registration root OID(s), or nullptr if the end of that subtree is reached. */
+static QSNMPVar * nextVar(const QSNMPVarMap & varMap, const netsnmp_handler_registration * reginfo,
+                          const oid * name, size_t nameLen, bool inclusive)
+{
+    QSNMPVarMap::const_iterator it = inclusive ? varMap.lowerBound(name, nameLen) : varMap.upperBound(name, nameLen);
+    for(; it != varMap.constEnd(); ++it)
+    {
+        /* Variables are ordered by OID, so the first one outside of the subtree ends the search */
+        if(!isUnderRegistration(it.key(), reginfo))
+            return nullptr;
+
+        /* Skip variables that cannot be read */
+        if((*it)->maxAccess() >= QSNMPMaxAccess_ReadOnly)
+            return *it;
+    }
+    return nullptr;
+}
+
+/* Splits the OID of a table cell (entryOid.fieldId.index) into the column's fieldId and the row's index.
+ * Returns false if the OID is not the OID of a cell of the table. */
+static bool splitCellOid(const QSNMPTable * table, const oid * name, size_t nameLen, quint32 * fieldId, QSNMPOid * index)
+{
+    const QSNMPOid & entryOid = table->snmpEntryOid();
+    size_t entryLen = entryOid.size();
+    if((nameLen < entryLen+2) || (qsnmpOidCompare(name, entryLen, entryOid.constData(), entryLen) != 0))
+        return false;
+    if((quint64)name[entryLen] > 0xFFFFFFFFull)
+        return false;
+    *fieldId = (quint32)name[entryLen];
+    *index = convertOidSnmpToQt((oid *)name + entryLen+1, nameLen - entryLen-1);
+    return true;
+}
+
+/* Writes the OID of a table cell (entryOid.fieldId.index) into a Net-SNMP variable binding.
+ * Returns false if that OID is longer than the Net-SNMP maximum. */
+static bool setCellOid(netsnmp_variable_list * varbind, const QSNMPTable * table, quint32 fieldId, const QSNMPOid & index)
+{
+    const QSNMPOid & entryOid = table->snmpEntryOid();
+    size_t snmpOidLen = entryOid.size() + 1 + index.size();
+    if(snmpOidLen > MAX_OID_LEN)
+        return false;
+    oid snmpOid[MAX_OID_LEN];
+    size_t k = 0;
+    for(int i=0; i<entryOid.size(); i++)
+        snmpOid[k++] = entryOid[i];
+    snmpOid[k++] = fieldId;
+    for(int i=0; i<index.size(); i++)
+        snmpOid[k++] = index[i];
+    snmp_set_var_objid(varbind, snmpOid, snmpOidLen);
+    return true;
+}
+
+/* Resolves a GETNEXT request against a table's data source: returns the column and index of the first cell
+ * following the requested OID (or equal to it if 'inclusive'), along with its value, walking the table column
+ * by column in the order of the rows' indexes. Returns false if the end of the table is reached. */
+static bool nextCell(QSNMPTable * table, const oid * name, size_t nameLen, bool inclusive,
+                     const QSNMPTableColumn ** column, QSNMPOid * index, QVariant * v)
+{
+    const QSNMPOid & entryOid = table->snmpEntryOid();
+    const QList<QSNMPTableColumn> & columns = table->snmpColumns();
+    size_t entryLen = entryOid.size();
+
+    /* Position of the requested OID in the table: the first column to walk, and the index to resume from
+     * within that column if the OID is under it. OIDs before the table start from its first cell. */
+    size_t commonLen = qMin(nameLen, entryLen);
+    int rc = qsnmpOidCompare(name, commonLen, entryOid.constData(), commonLen);
+    if(rc > 0)
+        return false;
+    int first = 0;
+    bool resume = false;
+    QSNMPOid start;
+    if((rc == 0) && (nameLen > entryLen))
+    {
+        while((first < columns.size()) && ((oid)columns[first].fieldId < name[entryLen]))
+            first++;
+        if((first < columns.size()) && ((oid)columns[first].fieldId == name[entryLen]) && (nameLen > entryLen+1))
+        {
+            start = convertOidSnmpToQt((oid *)name + entryLen+1, nameLen - entryLen-1);
+            resume = true;
+        }
+    }
+
+    /* Walk the readable columns, skipping the holes of sparse tables */
+    for(int k=first; k<columns.size(); k++, resume=false)
+    {
+        const QSNMPTableColumn & col = columns[k];
+        if(col.maxAccess < QSNMPMaxAccess_ReadOnly)
+            continue;
+        QSNMPOid next;
+        bool found;
+        if(resume)
+        {
+            if(inclusive)
+            {
+                *v = table->snmpGetCell(start, col.fieldId);
+                if(v->isValid())
+                {
+                    *column = &col;
+                    *index = start;
+                    return true;
+                }
+            }
+            found = table->snmpNextIndex(start, next);
+        }
+        else
+            found = table->snmpFirstIndex(next);
+        while(found)
+        {
+            *v = table->snmpGetCell(next, col.fieldId);
+            if(v->isValid())
+            {
+                *column = &col;
+                *index = next;
+                return true;
+            }
+
+            /* Indexes must keep increasing, so that a faulty data source cannot loop forever */
+            QSNMPOid current = next;
+            found = table->snmpNextIndex(current, next) && (current < next);
+        }
+    }
+    return false;
+}
+
+
+
+/****************************************************************/
+/******************** SNMP STATISTICS MODULE ********************/
+/****************************************************************/
+
+/* Number of rows of the slowest modules table */
+static const int statsSlowestModules = 5;
+
+/* QSNMPStatsModule class definition: the agent's self-monitoring MIB subtree (see QSNMPAgent::setStatisticsEnabled).
+ * Counters are bound to the agent's atomic counters, the other values are computed upon requests:
+ *   groupOid.1.0   getRequests         Counter64
+ *   groupOid.2.0   getNextRequests     Counter64
+ *   groupOid.3.0   setRequests         Counter64
+ *   groupOid.4.0   requestErrors       Counter64
+ *   groupOid.5.0   handlerLatencyP50   Gauge (microseconds)
+ *   groupOid.6.0   handlerLatencyP99   Gauge (microseconds)
+ *   groupOid.7.0   registeredVars      Gauge
+ *   groupOid.8.0   registerFailures    Counter64
+ *   groupOid.9.0   trapsSent           Counter64
+ *   groupOid.10.0  trapsSuppressed     Counter64
+ *   groupOid.11.0  trapsDropped        Counter64
+ *   groupOid.12.1  slowModuleEntry, indexed by rank (1 = most time spent in get callbacks):
+ *                  .1 slowModuleName (OCTET-STRING), .2 slowModuleGetCalls (Counter64),
+ *                  .3 slowModuleGetTime (Counter64, microseconds), .4 slowModuleGetMaxTime (Gauge, microseconds) */
+class QSNMPStatsModule : public QSNMPModule
+{
+
+public:
+                                QSNMPStatsModule(QSNMPAgent * snmpAgent, const QSNMPOid & groupOid,
+                                                 std::atomic<quint64> * getRequests, std::atomic<quint64> * getNextRequests,
+                                                 std::atomic<quint64> * setRequests, std::atomic<quint64> * requestErrors,
+                                                 std::atomic<quint64> * registerFailures);
+
+    /* SNMP module get/set variable value implementation */
+    virtual QVariant            snmpGetValue(const QSNMPVar * var);
+    virtual bool                snmpSetValue(const QSNMPVar * var, const QVariant & v);
+
+private:
+    QSNMPOid                    mEntryOid;
+
+};
+
+/* Constructor for the self-monitoring module, creates its variables under 'groupOid'. */
+QSNMPStatsModule::QSNMPStatsModule(QSNMPAgent * snmpAgent, const QSNMPOid & groupOid,
+                                   std::atomic<quint64> * getRequests, std::atomic<quint64> * getNextRequests,
+                                   std::atomic<quint64> * setRequests, std::atomic<quint64> * requestErrors,
+                                   std::atomic<quint64> * registerFailures) : QSNMPModule(snmpAgent)
+{
+    snmpAgent->beginBatch();
+    this->snmpCreateBoundVar("getRequests", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 1, getRequests);
+    this->snmpCreateBoundVar("getNextRequests", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 2, getNextRequests);
+    this->snmpCreateBoundVar("setRequests", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 3, setRequests);
+    this->snmpCreateBoundVar("requestErrors", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 4, requestErrors);
+    this->snmpCreateVar("handlerLatencyP50", QSNMPType_Gauge, QSNMPMaxAccess_ReadOnly, groupOid, 5);
+    this->snmpCreateVar("handlerLatencyP99", QSNMPType_Gauge, QSNMPMaxAccess_ReadOnly, groupOid, 6);
+    this->snmpCreateVar("registeredVars", QSNMPType_Gauge, QSNMPMaxAccess_ReadOnly, groupOid, 7);
+    this->snmpCreateBoundVar("registerFailures", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 8, registerFailures);
+    this->snmpCreateVar("trapsSent", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 9);
+    this->snmpCreateVar("trapsSuppressed", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 10);
+    this->snmpCreateVar("trapsDropped", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, groupOid, 11);
+    mEntryOid = QSNMPOid() << groupOid << 12 << 1;
+    for(quint32 rank=1; rank<=(quint32)statsSlowestModules; rank++)
+    {
+        QSNMPOid indexes = QSNMPOid() << rank;
+        this->snmpCreateVar("slowModuleName", QSNMPType_OctetStr, QSNMPMaxAccess_ReadOnly, mEntryOid, 1, indexes);
+        this->snmpCreateVar("slowModuleGetCalls", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, mEntryOid, 2, indexes);
+        this->snmpCreateVar("slowModuleGetTime", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, mEntryOid, 3, indexes);
+        this->snmpCreateVar("slowModuleGetMaxTime", QSNMPType_Gauge, QSNMPMaxAccess_ReadOnly, mEntryOid, 4, indexes);
+    }
+    snmpAgent->commitBatch();
+}
+
+/* Returns the value of a self-monitoring variable. */
+QVariant QSNMPStatsModule::snmpGetValue(const QSNMPVar * var)
+{
+    QSNMPAgent * agent = this->snmpAgent();
+    if(var->groupOid() == mEntryOid)
+    {
+        /* Rank the other modules by time spent in their get callbacks */
+        QList<QSNMPModule *> modules = agent->modules();
+        modules.removeAll(this);
+        std::sort(modules.begin(), modules.end(), [](const QSNMPModule * a, const QSNMPModule * b)
+        {
+            return a->snmpGetTime() > b->snmpGetTime();
+        });
+        int rank = (int)var->oid().last();
+        QSNMPModule * module = (rank <= modules.size()) ? modules[rank-1] : nullptr;
+        switch(var->fieldId())
+        {
+        case 1:
+            return QVariant(module ? module->snmpModuleName() : QString());
+        case 2:
+            return QVariant((quint64)(module ? module->snmpGetCalls() : 0));
+        case 3:
+            return QVariant((quint64)(module ? module->snmpGetTime() : 0));
+        case 4:
+            return QVariant((quint32)(module ? qMin(module->snmpGetMaxTime(), (quint64)0xFFFFFFFF) : 0));
+        default:
+            return QVariant();
+        }
+    }
+    switch(var->fieldId())
+    {
+    case 5:
+        return QVariant(agent->handlerLatency(50));
+    case 6:
+        return QVariant(agent->handlerLatency(99));
+    case 7:
+        return QVariant((quint32)agent->varMap().size());
+    case 9:
+        return QVariant(agent->trapsSent());
+    case 10:
+        return QVariant(agent->trapsSuppressed());
+    case 11:
+        return QVariant(agent->trapsDropped());
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+/* Self-monitoring variables are read-only. */
+bool QSNMPStatsModule::snmpSetValue(const QSNMPVar * var, const QVariant & v)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(v)
+    return false;
+}
+
+
+
+/****************************************************/
+/******************** SNMP AGENT ********************/
+/****************************************************/
+
+/* SNMP agent constructor, initializes Net-SNMP library as AgentX sub-agent. */
+QSNMPAgent::QSNMPAgent(const QString & agentName, const QString & agentAddr) : mVarPool(sizeof(QSNMPVar))
+{
+    /* Initialize member variables */
+    mAgentName = agentName;
+    mRegistrationMode = QSNMPRegistration_Instance;
+    mEventMode = QSNMPEventMode_Polling;
+    mTimer.start();
+    mThreadMode = QSNMPThreadMode_Caller;
+    mThread = nullptr;
+    mOwnerThread = nullptr;
+    mStopping = 0;
+    mNextRequestToken = 1;
+    mHandlerDepth = 0;
+    mBatchDepth = 0;
+    mLogMask.storeRelease(qsnmpLogMaskAll);
+    mTrapsEnabled = true;
+    mTrapCoalescingMs = 0;
+    mTrapRate = 0;
+    mTrapBurst = 1;
+    mTrapSeq = 0;
+    mTrapsSent = 0;
+    mTrapsSuppressed = 0;
+    mTrapsDropped = 0;
+    mStatsEnabled = false;
+    mStatsGetRequests = 0;
+    mStatsGetNextRequests = 0;
+    mStatsSetRequests = 0;
+    mStatsRequestErrors = 0;
+    mStatsRegisterFailures = 0;
+    mStatsLastPdu = 0;
+    mStatsLastErrorPdu = 0;
+    for(int k=0; k<latencyBuckets; k++)
+        mStatsLatency[k] = 0;
+    mStatsModule = nullptr;
+    mNextModuleGeneration = 1;
+
+    /* Logs may be emitted from the agent thread or from module threads */
+    qRegisterMetaType<QSNMPLogType_e>("QSNMPLogType_e");
+
+    /* Event processing timers */
+    mPollTimer = new QTimer(this);
+    mPollTimer->setSingleShot(true);
+    connect(mPollTimer, SIGNAL(timeout()), this, SLOT(processEvents()));
+    mTimeoutTimer = new QTimer(this);
+    mTimeoutTimer->setSingleShot(true);
+    connect(mTimeoutTimer, SIGNAL(timeout()), this, SLOT(processTimeout()));
+    mTrapTimer = new QTimer(this);
+    mTrapTimer->setSingleShot(true);
+    connect(mTrapTimer, SIGNAL(timeout()), this, SLOT(flushTraps()));
+
+    /* Initialize agentX/SNMP libraries */
+    netsnmp_ds_set_boolean(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_ROLE, 1);
+    if(!mAgentName.isEmpty())
+        netsnmp_ds_set_string(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_X_SOCKET, agentAddr.toStdString().c_str());
+    init_agent(mAgentName.toStdString().c_str());
+    init_snmp(mAgentName.toStdString().c_str());
+
+    /* Initial event processing start */
+    mPollTimer->start(0);
+}
+
+/* SNMP agent destructor, shutdowns Net-SNMP library. */
+QSNMPAgent::~QSNMPAgent()
+{
+    if(mThread)
+        this->stopThread();
+    delete mStatsModule;
+    this->releaseColumns();
+    foreach(void * cache, mDelegatedGets)
+        netsnmp_free_delegated_cache((netsnmp_delegated_cache *)cache);
+    mDelegatedGets.clear();
+    foreach(const QueuedTrap & trap, mTrapQueue)
+        snmp_free_varbind((netsnmp_variable_list *)trap.varbinds);
+    mTrapQueue.clear();
+    qDeleteAll(mSocketNotifiers);
+    mSocketNotifiers.clear();
+    snmp_shutdown(mAgentName.toStdString().c_str());
+    shutdown_agent();
+}
+
+/* Returns the map of SNMP variables managed by this agent.
+ * In QSNMPThreadMode_Worker mode, the map is modified by the threads that create/delete variables,
+ * and should thus only be iterated while no variable is being created or deleted. */
+const QSNMPVarMap & QSNMPAgent::varMap() const
+{
+    return mVarMap;
+}
+
+/* Returns the registration mode used for the variables registered from now on. */
+QSNMPRegistration_e QSNMPAgent::registrationMode() const
+{
+    return mRegistrationMode;
+}
+
+/* Sets the registration mode used for the variables registered from now on.
+ * In QSNMPRegistration_Instance mode (default), each variable is registered with the Net-SNMP library
+ * on its own, and the master agent resolves GETNEXT requests from its list of registrations.
+ * In QSNMPRegistration_Group mode, all variables sharing the same 'groupOid' (i.e. a group of scalars,
+ * or a whole table entry) are served by a single subtree registration of 'groupOid', registered with
+ * the first variable of that group and unregistered with the last one. GETNEXT requests are then
+ * resolved internally against the variable map, so that the registration cost only depends on the
+ * number of groups, not on the number of variables.
+ * Variables that are already registered are not affected by a mode change. */
+void QSNMPAgent::setRegistrationMode(QSNMPRegistration_e mode)
+{
+    mRegistrationMode = mode;
+}
+
+/* Registers a SNMP variable to this agent.
+ * This function is called by the QSNMPModule snmpCreateVar function and
+ * should typically not be called directly by the user application.
+ * When called from another thread than the agent's one (QSNMPThreadMode_Worker), the variable is
+ * added to the map right away but registered with the Net-SNMP library later on by the agent thread,
+ * in which case a registration failure is only reported by the RegisterFail log.
+ * Returns true on success, or false on failure. */
+bool QSNMPAgent::registerVar(QSNMPVar * var)
+{
+    /* OIDs longer than the Net-SNMP maximum cannot be registered (nor bound in traps) */
+    if(var->oid().size() > MAX_OID_LEN)
+    {
+        mStatsRegisterFailures.fetch_add(1, std::memory_order_relaxed);
+        if(this->logEnabled(QSNMPLogType_RegisterFail))
+            emit this->newLog(QSNMPLogType_RegisterFail,
+                              QString("Could not register SNMP variable %1: OID longer than %2 arcs").arg(var->fullName()).arg(MAX_OID_LEN));
+        return false;
+    }
+
+    /* Check if already registered, and add to map */
+    {
+        QMutexLocker locker(&mVarMapLock);
+        if(!mVarMap.insert(var))
+        {
+            mStatsRegisterFailures.fetch_add(1, std::memory_order_relaxed);
+            if(this->logEnabled(QSNMPLogType_RegisterFail))
+                emit this->newLog(QSNMPLogType_RegisterFail,
+                                  QString("Could not register SNMP variable %1: already registered").arg(var->fullName()));
+            return false;
+        }
+    }
+
+    /* Notify variables are not actually registered with the Net-SNMP library */
+    if(var->maxAccess() != QSNMPMaxAccess_Notify)
+    {
+        QMutexLocker locker(&mVarMapLock);
+        if(mBatchDepth > 0)
+        {
+            /* Registration deferred to commitBatch */
+            BatchRegistration reg;
+            reg.var = var;
+            reg.name = var->name();
+            reg.fullName = var->fullName();
+            reg.oid = var->oid();
+            reg.groupOid = var->groupOid();
+            reg.maxAccess = var->maxAccess();
+            reg.mode = mRegistrationMode;
+            mBatchIndexes.insert(var, mBatch.size());
+            mBatch << reg;
+            return true;
+        }
+        locker.unlock();
+        if(QThread::currentThread() == this->thread())
+        {
+            QString error;
+            void * registration = this->registerOid(var, var->name(), var->oid(), var->groupOid(), var->maxAccess(),
+                                                    mRegistrationMode, &error);
+            if(!registration)
+            {
+                QMutexLocker locker(&mVarMapLock);
+                mVarMap.remove(var);
+                if(this->logEnabled(QSNMPLogType_RegisterFail))
+                    emit this->newLog(QSNMPLogType_RegisterFail,
+                                      QString("Could not register SNMP variable %1: %2").arg(var->fullName()).arg(error));
+                return false;
+            }
+        }
+        else
+        {
+            /* Net-SNMP library is only used from the agent thread, the variable may be deleted in the meantime */
+            QString name = var->name();
+            QString fullName = var->fullName();
+            QSNMPOid oid = var->oid();
+            QSNMPOid groupOid = var->groupOid();
+            QSNMPMaxAccess_e maxAccess = var->maxAccess();
+            QSNMPRegistration_e mode = mRegistrationMode;
+            QMetaObject::invokeMethod(this, [this, var, name, fullName, oid, groupOid, maxAccess, mode]()
+            {
+                QString error;
+                if(!this->registerOid(var, name, oid, groupOid, maxAccess, mode, &error) && this->logEnabled(QSNMPLogType_RegisterFail))
+                    emit this->newLog(QSNMPLogType_RegisterFail,
+                                      QString("Could not register SNMP variable %1: %2").arg(fullName).arg(error));
+            }, Qt::QueuedConnection);
+        }
+    }
+
+    /* Done, batches are only logged once committed */
+    if(this->logEnabled(QSNMPLogType_RegisterOK) && !this->inBatch())
+        emit this->newLog(QSNMPLogType_RegisterOK,
+                          QString("Registered SNMP variable %1").arg(var->fullName()));
+    return true;
+}
+
+/* Returns true while a batch of variable registrations is in progress (see beginBatch). */
+bool QSNMPAgent::inBatch()
+{
+    QMutexLocker locker(&mVarMapLock);
+    return (mBatchDepth > 0);
+}
+
+/* Unregisters a SNMP variable from this agent.
+ * This function is called by the QSNMPModule snmpDeleteVar function and
+ * should typically not be called directly by the user application.
+ * When called from another thread than the agent's one, the variable is removed from the map
+ * right away (so that it can be deleted) but unregistered from the Net-SNMP library later on. */
+void QSNMPAgent::unregisterVar(QSNMPVar * var)
+{
+    /* Remove from map, whatever the access level, so that no dangling pointer is left behind */
+    {
+        QMutexLocker locker(&mVarMapLock);
+        if(!mVarMap.remove(var))
+        {
+            if(this->logEnabled(QSNMPLogType_UnregisterFail))
+                emit this->newLog(QSNMPLogType_UnregisterFail,
+                                  QString("Could not unregister SNMP variable %1: not registered").arg(var->fullName()));
+            return;
+        }
+    }
+    if(this->logEnabled(QSNMPLogType_UnregisterOK))
+        emit this->newLog(QSNMPLogType_UnregisterOK,
+                          QString("Unregistered SNMP variable %1").arg(var->fullName()));
+
+    /* Variables of an uncommitted batch are not registered with the Net-SNMP library yet */
+    bool pending = false;
+    {
+        QMutexLocker locker(&mVarMapLock);
+        pending = this->removeFromBatch(var);
+    }
+
+    /* Notify variables are not actually registered with the Net-SNMP library */
+    if((var->maxAccess() != QSNMPMaxAccess_Notify) && !pending)
+    {
+        if(QThread::currentThread() == this->thread())
+            this->unregisterOid(var, var->oid(), var->groupOid());
+        else
+        {
+            QSNMPOid oid = var->oid();
+            QSNMPOid groupOid = var->groupOid();
+            QMetaObject::invokeMethod(this, [this, var, oid, groupOid]()
+            {
+                this->unregisterOid(var, oid, groupOid);
+            }, Qt::QueuedConnection);
+        }
+    }
+}
+
+/* Unregisters several variables at once (i.e. when a module or the rows of a table are deleted): the
+ * variable map is updated under a single lock, a single summary log is emitted, and the Net-SNMP
+ * registrations are released in a single pass on the agent thread (group and range registrations
+ * being unregistered only once, along with their last variable). */
+void QSNMPAgent::unregisterVars(const QSNMPVarList & varList)
+{
+    if(varList.isEmpty())
+        return;
+
+    /* Remove from map and from the uncommitted batch, whatever the access level */
+    int failed = 0;
+    QSNMPVarList vars;
+    QVector<QSNMPOid> oids;
+    QVector<QSNMPOid> groupOids;
+    vars.reserve(varList.size());
+    oids.reserve(varList.size());
+    groupOids.reserve(varList.size());
+    {
+        QMutexLocker locker(&mVarMapLock);
+        foreach(QSNMPVar * var, varList)
+        {
+            if(!mVarMap.remove(var))
+            {
+                failed++;
+                if(this->logEnabled(QSNMPLogType_UnregisterFail))
+                    emit this->newLog(QSNMPLogType_UnregisterFail,
+                                      QString("Could not unregister SNMP variable %1: not registered").arg(var->fullName()));
+                continue;
+            }
+            if((var->maxAccess() == QSNMPMaxAccess_Notify) || this->removeFromBatch(var))
+                continue;
+            vars << var;
+            oids << var->oid();
+            groupOids << var->groupOid();
+        }
+    }
+    if(this->logEnabled(QSNMPLogType_UnregisterOK) && (failed < varList.size()))
+        emit this->newLog(QSNMPLogType_UnregisterOK,
+                          QString("Unregistered %1 SNMP variables").arg(varList.size()-failed));
+
+    /* Release the registrations */
+    if(vars.isEmpty())
+        return;
+    if(QThread::currentThread() == this->thread())
+        this->unregisterOids(vars, oids, groupOids);
+    else
+    {
+        QMetaObject::invokeMethod(this, [this, vars, oids, groupOids]()
+        {
+            this->unregisterOids(vars, oids, groupOids);
+        }, Qt::QueuedConnection);
+    }
+}
+
+/* OIDs released from a same Net-SNMP registration (see unregisterOids) */
+typedef struct
+{
+    int                         first;  // Index of the first OID of the registration
+    int                         count;
+} RegistrationRelease;
+
+/* Unregisters several variables' OIDs from the Net-SNMP library, from the agent thread (see unregisterVars).
+ * The OIDs are first counted per registration, so that each group or range registration is released
+ * once for all its OIDs. Instance registrations are still unregistered one by one. */
+void QSNMPAgent::unregisterOids(const QSNMPVarList & vars, const QVector<QSNMPOid> & oids, const QVector<QSNMPOid> & groupOids)
+{
+    QHash<void *, RegistrationRelease> releases;
+    releases.reserve(vars.size());
+    for(int k=0; k<vars.size(); k++)
+    {
+        QHash<const QSNMPVar *, void *>::iterator it = mRegistrations.find(vars[k]);
+        if(it == mRegistrations.end())
+            continue;
+        QHash<void *, RegistrationRelease>::iterator release = releases.find(it.value());
+        if(release == releases.end())
+        {
+            RegistrationRelease newRelease;
+            newRelease.first = k;
+            newRelease.count = 0;
+            release = releases.insert(it.value(), newRelease);
+        }
+        release->count++;
+        mRegistrations.erase(it);
+    }
+    for(QHash<void *, RegistrationRelease>::const_iterator release = releases.constBegin(); release != releases.constEnd(); ++release)
+        this->releaseRegistration(release.key(), oids[release.value().first], groupOids[release.value().first],
+                                  release.value().count);
+}
+
+/* Registers a variable's OID with the Net-SNMP library, from the agent thread.
+ * In QSNMPRegistration_Group mode, the registration of the variable's group is shared.
+ * Returns the registration, or nullptr on failure in which case 'error' is set to the failure reason. */
+void * QSNMPAgent::registerOid(const QSNMPVar * var, const QString & name, const QSNMPOid & oid, const QSNMPOid & groupOid,
+                               QSNMPMaxAccess_e maxAccess, QSNMPRegistration_e mode, QString * error)
+{
+    netsnmp_handler_registration * reginfo = nullptr;
+    if(mode == QSNMPRegistration_Group)
+    {
+        /* Register the group subtree with its first variable, subtree handler is always read-write
+         * and the access level is checked per variable upon requests */
+        QMap<QSNMPOid, GroupRegistration>::iterator it = mGroupRegistrations.find(groupOid);
+        if(it == mGroupRegistrations.end())
+        {
+            reginfo = registerHandler(this, toString(groupOid), groupOid, true, false, 0, error);
+            if(!reginfo)
+            {
+                *error = QString("group %1").arg(*error);
+                mStatsRegisterFailures.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            GroupRegistration group;
+            group.registration = reginfo;
+            group.refCount = 0;
+            it = mGroupRegistrations.insert(groupOid, group);
+        }
+        it->refCount++;
+        reginfo = (netsnmp_handler_registration *)it->registration;
+    }
+    else
+    {
+        /* Variables re-created within a range registration share it again */
+        QHash<QSNMPOid, QList<RangeRegistration> >::iterator ranges = mRangeRegistrations.find(oid.mid(0, oid.size()-1));
+        if(ranges != mRangeRegistrations.end())
+        {
+            for(QList<RangeRegistration>::iterator range = ranges->begin(); range != ranges->end(); ++range)
+            {
+                if((oid.last() >= range->first) && (oid.last() <= range->last) && (range->readWrite == (maxAccess==QSNMPMaxAccess_ReadWrite)))
+                {
+                    range->refCount++;
+                    mRegistrations.insert(var, range->registration);
+                    return range->registration;
+                }
+            }
+        }
+
+        /* Register instance */
+        reginfo = registerHandler(this, name, oid, (maxAccess==QSNMPMaxAccess_ReadWrite), true, 0, error);
+        if(!reginfo)
+        {
+            mStatsRegisterFailures.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+    }
+    mRegistrations.insert(var, reginfo);
+    return reginfo;
+}
+
+/* Unregisters a variable's OID from the Net-SNMP library, from the agent thread.
+ * Group registrations are only unregistered along with the last variable of the group. */
+void QSNMPAgent::unregisterOid(const QSNMPVar * var, const QSNMPOid & oid, const QSNMPOid & groupOid)
+{
+    QHash<const QSNMPVar *, void *>::iterator it = mRegistrations.find(var);
+    if(it == mRegistrations.end())
+        return;
+    void * registration = it.value();
+    mRegistrations.erase(it);
+    this->releaseRegistration(registration, oid, groupOid, 1);
+}
+
+/* Releases 'count' variables of a Net-SNMP registration, from the agent thread, given one of these variables'
+ * OID and group OID. Group and range registrations are only unregistered along with their last variable. */
+void QSNMPAgent::releaseRegistration(void * registration, const QSNMPOid & oid, const QSNMPOid & groupOid, int count)
+{
+    QMap<QSNMPOid, GroupRegistration>::iterator group = mGroupRegistrations.find(groupOid);
+    if((group != mGroupRegistrations.end()) && (group->registration == registration))
+    {
+        group->refCount -= count;
+        if(group->refCount <= 0)
+        {
+            netsnmp_unregister_handler((netsnmp_handler_registration *)group->registration);
+            mGroupRegistrations.erase(group);
+        }
+        return;
+    }
+
+    /* Range registrations are only unregistered along with the last variable of the range */
+    QHash<QSNMPOid, QList<RangeRegistration> >::iterator ranges = mRangeRegistrations.find(oid.mid(0, oid.size()-1));
+    if(ranges != mRangeRegistrations.end())
+    {
+        for(QList<RangeRegistration>::iterator range = ranges->begin(); range != ranges->end(); ++range)
+        {
+            if(range->registration == registration)
+            {
+                range->refCount -= count;
+                if(range->refCount <= 0)
+                {
+                    netsnmp_unregister_handler((netsnmp_handler_registration *)range->registration);
+                    ranges->erase(range);
+                    if(ranges->isEmpty())
+                        mRangeRegistrations.erase(ranges);
+                }
+                return;
+            }
+        }
+    }
+    netsnmp_unregister_handler((netsnmp_handler_registration *)registration);
+}
+
+/* Starts a batch of variable registrations: until the matching commitBatch call, the variables are
+ * added to the map (so that duplicates are still rejected) but their registration with the Net-SNMP
+ * library is deferred, and no RegisterOK log is emitted. Batches can be nested. */
+void QSNMPAgent::beginBatch()
+{
+    QMutexLocker locker(&mVarMapLock);
+    mBatchDepth++;
+}
+
+/* Ends a batch of variable registrations (see beginBatch), and registers all the batch's variables with
+ * the Net-SNMP library at once, from the agent thread: contiguous instance OIDs (same parent OID,
+ * consecutive last arc, i.e. a table column with consecutive indexes, and same access) are coalesced
+ * into range registrations. A single summary RegisterOK log is emitted, and a RegisterFail log for
+ * each variable that could not be registered. */
+void QSNMPAgent::commitBatch()
+{
+    QVector<BatchRegistration> batch;
+    {
+        QMutexLocker locker(&mVarMapLock);
+        if((mBatchDepth == 0) || (--mBatchDepth > 0))
+            return;
+        batch.swap(mBatch);
+        mBatchIndexes.clear();
+    }
+    if(QThread::currentThread() == this->thread())
+        this->registerBatch(batch);
+    else
+    {
+        QMetaObject::invokeMethod(this, [this, batch]()
+        {
+            this->registerBatch(batch);
+        }, Qt::QueuedConnection);
+    }
+}
+
+/* Removes a variable from the uncommitted batch (with the variable map locked), in constant time by moving
+ * the last batch registration in its place. Returns false if the variable is not in the batch. */
+bool QSNMPAgent::removeFromBatch(QSNMPVar * var)
+{
+    QHash<QSNMPVar *, int>::iterator it = mBatchIndexes.find(var);
+    if(it == mBatchIndexes.end())
+        return false;
+    int k = it.value();
+    mBatchIndexes.erase(it);
+    if(k != mBatch.size()-1)
+    {
+        mBatch[k] = mBatch.last();
+        mBatchIndexes[mBatch[k].var] = k;
+    }
+    mBatch.removeLast();
+    return true;
+}
+
+/* Registers a batch of variables with the Net-SNMP library, from the agent thread (see commitBatch). */
+void QSNMPAgent::registerBatch(QVector<BatchRegistration> batch)
+{
+    int failed = 0;
+    int registrations = 0;
+    QString error;
+
+    /* Group registrations are shared anyway */
+    int groups = mGroupRegistrations.size();
+    QVector<BatchRegistration> instances;
+    instances.reserve(batch.size());
+    foreach(const BatchRegistration & reg, batch)
+    {
+        if(reg.mode != QSNMPRegistration_Group)
+            instances << reg;
+        else if(!this->registerOid(reg.var, reg.name, reg.oid, reg.groupOid, reg.maxAccess, reg.mode, &error))
+        {
+            failed++;
+            if(this->logEnabled(QSNMPLogType_RegisterFail))
+                emit this->newLog(QSNMPLogType_RegisterFail,
+                                  QString("Could not register SNMP variable %1: %2").arg(reg.fullName).arg(error));
+        }
+    }
+    registrations += mGroupRegistrations.size() - groups;
+
+    /* Instance registrations, in OID order so that contiguous OIDs follow each other */
+    std::sort(instances.begin(), instances.end(), [](const BatchRegistration & a, const BatchRegistration & b)
+    {
+        return qsnmpOidCompare(a.oid.constData(), a.oid.size(), b.oid.constData(), b.oid.size()) < 0;
+    });
+    for(int first=0, last=0; first<instances.size(); first=last)
+    {
+        /* Find the run of contiguous OIDs */
+        const BatchRegistration & head = instances[first];
+        bool readWrite = (head.maxAccess == QSNMPMaxAccess_ReadWrite);
+        for(last=first+1; last<instances.size(); last++)
+        {
+            const QSNMPOid & prev = instances[last-1].oid;
+            const QSNMPOid & oid = instances[last].oid;
+            if((oid.size() != prev.size()) || (oid.last() != prev.last()+1) ||
+               (qsnmpOidCompare(oid.constData(), oid.size()-1, prev.constData(), prev.size()-1) != 0) ||
+               ((instances[last].maxAccess == QSNMPMaxAccess_ReadWrite) != readWrite))
+                break;
+        }
+
+        /* Register the run as a single range, or fall back to instance registrations */
+        if(last-first > 1)
+        {
+            netsnmp_handler_registration * reginfo = registerHandler(this, head.name, head.oid, readWrite, false,
+                                                                     instances[last-1].oid.last(), &error);
+            if(reginfo)
+            {
+                RangeRegistration range;
+                range.registration = reginfo;
+                range.first = head.oid.last();
+                range.last = instances[last-1].oid.last();
+                range.readWrite = readWrite;
+                range.refCount = last-first;
+                mRangeRegistrations[head.oid.mid(0, head.oid.size()-1)] << range;
+                for(int k=first; k<last; k++)
+                    mRegistrations.insert(instances[k].var, reginfo);
+                registrations++;
+                continue;
+            }
+        }
+        for(int k=first; k<last; k++)
+        {
+            const BatchRegistration & reg = instances[k];
+            if(this->registerOid(reg.var, reg.name, reg.oid, reg.groupOid, reg.maxAccess, reg.mode, &error))
+                registrations++;
+            else
+            {
+                failed++;
+                if(this->logEnabled(QSNMPLogType_RegisterFail))
+                    emit this->newLog(QSNMPLogType_RegisterFail,
+                                      QString("Could not register SNMP variable %1: %2").arg(reg.fullName).arg(error));
+            }
+        }
+    }
+
+    /* Summary */
+    if(this->logEnabled(QSNMPLogType_RegisterOK))
+        emit this->newLog(QSNMPLogType_RegisterOK,
+                          QString("Registered %1 SNMP variables with %2 registrations (%3 failed)")
+                                  .arg(batch.size()-failed).arg(registrations).arg(failed));
+}
+
+/* Registers a table to this agent, as a single subtree registration of its entry OID.
+ * This function is called by the QSNMPTable constructor and should typically not be called directly
+ * by the user application. When called from another thread than the agent's one, the table is registered
+ * with the Net-SNMP library later on by the agent thread, in which case a registration failure is only
+ * reported by the RegisterFail log.
+ * Returns true on success, or false on failure. */
+bool QSNMPAgent::registerTable(QSNMPTable * table)
+{
+    /* Subtree handler is read-write if any column is, the access level is checked per column upon requests */
+    bool readWrite = false;
+    foreach(const QSNMPTableColumn & column, table->snmpColumns())
+        readWrite |= (column.maxAccess == QSNMPMaxAccess_ReadWrite);
+    QString name = table->snmpName();
+    QSNMPOid entryOid = table->snmpEntryOid();
+    std::function<bool()> registration = [this, table, name, entryOid, readWrite]()
+    {
+        /* Registered with the map locked, so that the table cannot be deleted in the meantime */
+        QMutexLocker locker(&mVarMapLock);
+        if(!mPendingTables.removeOne(table))
+            return false;
+        QString error;
+        void * reginfo = registerHandler(this, name, entryOid, readWrite, false, 0, &error);
+        if(!reginfo)
+        {
+            mStatsRegisterFailures.fetch_add(1, std::memory_order_relaxed);
+            if(this->logEnabled(QSNMPLogType_RegisterFail))
+                emit this->newLog(QSNMPLogType_RegisterFail,
+                                  QString("Could not register SNMP table %1: %2").arg(name).arg(error));
+            return false;
+        }
+        mTables.insert(reginfo, table);
+        if(this->logEnabled(QSNMPLogType_RegisterOK))
+            emit this->newLog(QSNMPLogType_RegisterOK,
+                              QString("Registered SNMP table %1 (%2)").arg(name).arg(toString(entryOid)));
+        return true;
+    };
+    {
+        QMutexLocker locker(&mVarMapLock);
+        mPendingTables << table;
+    }
+    if(QThread::currentThread() == this->thread())
+        return registration();
+
+    /* Net-SNMP library is only used from the agent thread */
+    QMetaObject::invokeMethod(this, [registration]()
+    {
+        registration();
+    }, Qt::QueuedConnection);
+    return true;
+}
+
+/* Unregisters a table from this agent.
+ * This function is called by the QSNMPTable destructor and should typically not be called directly
+ * by the user application. When called from another thread than the agent's one, the table is removed
+ * right away (so that it can be deleted) but unregistered from the Net-SNMP library later on. */
+void QSNMPAgent::unregisterTable(QSNMPTable * table)
+{
+    /* Remove from tables, whether registered yet or not */
+    void * reginfo = nullptr;
+    {
+        QMutexLocker locker(&mVarMapLock);
+        if(!mPendingTables.removeOne(table))
+        {
+            reginfo = mTables.key(table, nullptr);
+            if(!reginfo)
+                return;
+            mTables.remove(reginfo);
+        }
+    }
+    if(this->logEnabled(QSNMPLogType_UnregisterOK))
+        emit this->newLog(QSNMPLogType_UnregisterOK,
+                          QString("Unregistered SNMP table %1").arg(table->snmpName()));
+
+    /* Unregister from the Net-SNMP library, from the agent thread */
+    if(!reginfo)
+        return;
+    if(QThread::currentThread() == this->thread())
+        netsnmp_unregister_handler((netsnmp_handler_registration *)reginfo);
+    else
+    {
+        QMetaObject::invokeMethod(this, [reginfo]()
+        {
+            netsnmp_unregister_handler((netsnmp_handler_registration *)reginfo);
+        }, Qt::QueuedConnection);
+    }
+}
+
+/* The main variable GET/SET callback handler, called by the Net-SNMP library on GET/SET messages.
+ * Note that here we use the same callback for all variables, so that implementation-specific
+ * behavior is determined outside of the QSNMP context. */
+int QSNMPAgent::handler(void * _handler, void * _reginfo, void * _reqinfo, void * _requests)
+{
+    int rc;
+    mHandlerDepth++;
+    if(!mStatsEnabled.load(std::memory_order_relaxed))
+        rc = this->processRequests(_handler, _reginfo, _reqinfo, _requests);
+    else
+    {
+        QElapsedTimer timer;
+        timer.start();
+        rc = this->processRequests(_handler, _reginfo, _reqinfo, _requests);
+        this->recordRequest(_reqinfo, timer.nsecsElapsed(), rc);
+    }
+    mHandlerDepth--;
+    return rc;
+}
+
+/* Processes the requests of a handler call (see handler). */
+int QSNMPAgent::processRequests(void * _handler, void * _reginfo, void * _reqinfo, void * _requests)
+{
+    netsnmp_handler_registration * reginfo = (netsnmp_handler_registration *)_reginfo;
+    netsnmp_agent_request_info * reqinfo = (netsnmp_agent_request_info * )_reqinfo;
+    netsnmp_request_info * requests = (netsnmp_request_info * )_requests;
+
+    /* Variables list */
+    netsnmp_variable_list * netsnmp_varlist = requests->requestvb;
+
+    /* Variables may be added or removed by other threads, unless the map is locked */
+    QMutexLocker locker(&mVarMapLock);
+
+    /* Tables are resolved by their own data source */
+    if(!mTables.isEmpty())
+    {
+        QSNMPTable * table = mTables.value(reginfo);
+        if(table)
+        {
+            /* On the table's thread if it has a call context, the table may be deleted while waiting for it */
+            int rc = SNMP_ERR_GENERR;
+            this->callModule(callContext(table->snmpCallContext()), locker, [&]()
+            {
+                if(mTables.value(reginfo) == table)
+                    rc = this->processTableRequests(table, reginfo, reqinfo, requests);
+            });
+            return rc;
+        }
+    }
+
+    /* Action */
+    if((reqinfo->mode == MODE_GET) || (reqinfo->mode == MODE_GETNEXT))
+    {
+        /* Multiple variables supported for GET requests, first resolve all of them */
+        bool log = this->logEnabled(QSNMPLogType_GET);
+        QVector<PendingGet> pendingGets;
+        for(netsnmp_request_info * request = requests; request; request = request->next)
+        {
+            if(request->processed)
+                continue;
+            netsnmp_varlist = request->requestvb;
+
+            /* Get the corresponding variable from agent, straight from the raw OID buffer */
+            QSNMPVar * var = nullptr;
+            if(reqinfo->mode == MODE_GETNEXT)
+            {
+                /* GETNEXT requests only reach this handler for group and range registrations (the instance helper
+                 * turns them into GET requests), resolve them against the variable map. If the end of the group
+                 * subtree is reached, leave the request untouched so that Net-SNMP carries on with the
+                 * next registration. */
+                var = nextVar(mVarMap, reginfo, netsnmp_varlist->name, netsnmp_varlist->name_length, request->inclusive);
+                if(!var)
+                    continue;
+                oid snmpOid[MAX_OID_LEN];
+                size_t snmpOidLen;
+                convertOidQtToSnmp(var->oid(), snmpOid, &snmpOidLen);
+                snmp_set_var_objid(netsnmp_varlist, snmpOid, snmpOidLen);
+            }
+            else
+            {
+                /* Check access, should not be needed for instance registrations because the Net-SNMP library
+                 * will do it for us, but group registrations may be queried for any OID under the group */
+                var = mVarMap.find(netsnmp_varlist->name, netsnmp_varlist->name_length);
+                if(!var || (var->maxAccess() < QSNMPMaxAccess_ReadOnly))
+                {
+                    this->setRequestError(reqinfo, request, SNMP_NOSUCHINSTANCE);
+                    continue;
+                }
+            }
+
+            /* Read cached and direct values from user application right away, defer the others
+             * as well as all those of modules called on their own thread */
+            QObject * context = callContext(var->module()->snmpCallContext());
+            quint32 cacheGeneration = var->cacheGeneration();
+            QVariant v;
+            if(readCachedValue(var, netsnmp_varlist, log ? &v : nullptr))
+            {
+                if(log)
+                    this->logVarValue(QSNMPLogType_GET, "SNMP-GET: ", var, v);
+            }
+            else if(!context && timedRead(var->module(), mStatsEnabled.load(std::memory_order_relaxed), [&]()
+                    {
+                        return readVarValueDirect(var, netsnmp_varlist, log ? &v : nullptr);
+                    }))
+            {
+                cacheVarValue(var, netsnmp_varlist, cacheGeneration);
+                if(log)
+                    this->logVarValue(QSNMPLogType_GET, "SNMP-GET: ", var, v);
+            }
+            else
+            {
+                PendingGet pendingGet;
+                pendingGet.request = request;
+                pendingGet.var = var;
+                pendingGet.module = var->module();
+                pendingGet.generation = mModuleGenerations.value(var->module(), 0);
+                pendingGet.context = context;
+                pendingGets << pendingGet;
+            }
+        }
+
+        /* Then read the remaining values from user application, with a single call per module: group
+         * the variables by module (stable, so that each module gets its variables in request order),
+         * modules called directly first because the map is unlocked while calling the other ones */
+        std::stable_sort(pendingGets.begin(), pendingGets.end(), [](const PendingGet & a, const PendingGet & b)
+        {
+            if(a.context != b.context)
+                return a.context < b.context;
+            return a.module < b.module;
+        });
+        for(int first=0, last=0; first<pendingGets.size(); first=last)
+        {
+            for(last=first; (last<pendingGets.size()) && (pendingGets[last].module == pendingGets[first].module); last++);
+            const PendingGet & pendingGet = pendingGets[first];
+            bool ok = false;
+            bool deleted = false;
+            bool called = this->callModule(pendingGet.context, locker, [&]()
+            {
+                /* The module may have been deleted while the map was unlocked */
+                deleted = (mModuleGenerations.value(pendingGet.module, 0) != pendingGet.generation);
+                if(deleted)
+                    return;
+                ok = timedRead(pendingGet.module, mStatsEnabled.load(std::memory_order_relaxed), [&]()
+                {
+                    return this->readValues(_handler, reginfo, reqinfo, pendingGets, first, last, log,
+                                            pendingGet.context != nullptr);
+                });
+            });
+            if(!called)
+                deleted = (mModuleGenerations.value(pendingGet.module, 0) != pendingGet.generation);
+            if(deleted)
+            {
+                for(int k=first; k<last; k++)
+                    this->setRequestError(reqinfo, pendingGets[k].request, SNMP_NOSUCHOBJECT);
+                continue;
+            }
+            if(!called || !ok)
+                return SNMP_ERR_GENERR;
+        }
+    }
+    else
+    {
+        /* Multiple variables supported for SET requests, applied as a whole (best effort) by following the Net-SNMP
+         * SET transaction phases: RESERVE1 (check), RESERVE2, ACTION (set), then either COMMIT on success,
+         * FREE on a RESERVE failure, or UNDO on an ACTION failure (which restores the values already set, unless
+         * snmpSetUndo fails).
+         * Variables are looked up again at each phase, the pending values are kept per request. */
+        for(netsnmp_request_info * request = requests; request; request = request->next)
+        {
+            netsnmp_varlist = request->requestvb;
+            QSNMPVar * var = mVarMap.find(netsnmp_varlist->name, netsnmp_varlist->name_length);
+            QObject * context = var ? callContext(var->module()->snmpCallContext()) : nullptr;
+            bool called = this->callModule(context, locker, [&]()
+            {
+                /* Look the variable up again, the map was unlocked while waiting for the module's thread */
+                if(context)
+                    var = mVarMap.find(netsnmp_varlist->name, netsnmp_varlist->name_length);
+                QHash<void *, PendingSet>::iterator it = mPendingSets.find(request);
+                switch(reqinfo->mode)
+                {
+                case MODE_SET_RESERVE1:
+                {
+                    /* Get the corresponding variable from agent, straight from the raw OID buffer */
+                    if(!var)
+                    {
+                        this->setRequestError(reqinfo, request, SNMP_ERR_NOCREATION);
+                        break;
+                    }
+
+                    /* Check access, should not be needed for instance registrations because the Net-SNMP library
+                     * will do it for us, but group registrations are always writable */
+                    if(var->maxAccess() < QSNMPMaxAccess_ReadWrite)
+                    {
+                        this->setRequestError(reqinfo, request, SNMP_ERR_NOTWRITABLE);
+                        break;
+                    }
+
+                    /* Convert from SNMP to Qt data, and check value */
+                    PendingSet pendingSet;
+                    int rc = readVarbindValue(var->type(), netsnmp_varlist, pendingSet.value);
+                    if(rc != SNMP_ERR_NOERROR)
+                    {
+                        this->setRequestError(reqinfo, request, rc);
+                        break;
+                    }
+                    if(!var->check(pendingSet.value))
+                    {
+                        this->setRequestError(reqinfo, request, SNMP_ERR_WRONGVALUE);
+                        break;
+                    }
+                    pendingSet.applied = false;
+                    mPendingSets.insert(request, pendingSet);
+                    break;
+                }
+                case MODE_SET_RESERVE2:
+                    break;
+                case MODE_SET_ACTION:
+                {
+                    if(!var || (it == mPendingSets.end()))
+                    {
+                        this->setRequestError(reqinfo, request, SNMP_ERR_GENERR);
+                        break;
+                    }
+
+                    /* Write value to user application, keep the previous one for UNDO */
+                    if(this->logEnabled(QSNMPLogType_SET))
+                        this->logVarValue(QSNMPLogType_SET, "SNMP-SET: ", var, it->value);
+                    it->oldValue = var->get();
+                    var->invalidate();
+                    if(!var->set(it->value))
+                    {
+                        this->setRequestError(reqinfo, request, SNMP_ERR_BADVALUE);
+                        break;
+                    }
+                    it->applied = true;
+                    break;
+                }
+                case MODE_SET_COMMIT:
+                {
+                    if(var && (it != mPendingSets.end()))
+                        var->module()->snmpSetCommit(var, it->value);
+                    mPendingSets.remove(request);
+                    break;
+                }
+                case MODE_SET_UNDO:
+                {
+                    if(var && (it != mPendingSets.end()) && it->applied)
+                    {
+                        var->invalidate();
+                        if(!var->module()->snmpSetUndo(var, it->oldValue))
+                            this->setRequestError(reqinfo, request, SNMP_ERR_UNDOFAILED);
+                    }
+                    mPendingSets.remove(request);
+                    break;
+                }
+                case MODE_SET_FREE:
+                    mPendingSets.remove(request);
+                    break;
+                default:
+                    break;
+                }
+            });
+            if(!called)
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_GENERR);
+                if((reqinfo->mode == MODE_SET_COMMIT) || (reqinfo->mode == MODE_SET_UNDO) || (reqinfo->mode == MODE_SET_FREE))
+                    mPendingSets.remove(request);
+            }
+        }
+    }
+
+    /* Done */
+    return SNMP_ERR_NOERROR;
+}
+
+/* Processes the requests of a handler call for a table (see QSNMPTable), with the variable map locked: cells are
+ * resolved through the table's callbacks, and SET requests follow the same transaction phases as variables. */
+int QSNMPAgent::processTableRequests(QSNMPTable * table, void * _reginfo, void * _reqinfo, void * _requests)
+{
+    Q_UNUSED(_reginfo)
+    netsnmp_agent_request_info * reqinfo = (netsnmp_agent_request_info * )_reqinfo;
+    netsnmp_request_info * requests = (netsnmp_request_info * )_requests;
+
+    /* GET requests */
+    if((reqinfo->mode == MODE_GET) || (reqinfo->mode == MODE_GETNEXT))
+    {
+        bool log = this->logEnabled(QSNMPLogType_GET);
+        for(netsnmp_request_info * request = requests; request; request = request->next)
+        {
+            if(request->processed)
+                continue;
+            netsnmp_variable_list * varbind = request->requestvb;
+            const QSNMPTableColumn * column = nullptr;
+            QSNMPOid index;
+            QVariant v;
+            if(reqinfo->mode == MODE_GETNEXT)
+            {
+                /* If the end of the table is reached, leave the request untouched so that Net-SNMP carries on
+                 * with the next registration */
+                if(!nextCell(table, varbind->name, varbind->name_length, request->inclusive, &column, &index, &v))
+                    continue;
+                if(!setCellOid(varbind, table, column->fieldId, index))
+                {
+                    this->setRequestError(reqinfo, request, SNMP_ERR_GENERR);
+                    continue;
+                }
+            }
+            else
+            {
+                quint32 fieldId;
+                if(!splitCellOid(table, varbind->name, varbind->name_length, &fieldId, &index)
+                   || !(column = table->snmpColumn(fieldId)) || (column->maxAccess < QSNMPMaxAccess_ReadOnly))
+                {
+                    this->setRequestError(reqinfo, request, SNMP_NOSUCHOBJECT);
+                    continue;
+                }
+                v = table->snmpGetCell(index, fieldId);
+                if(!v.isValid())
+                {
+                    this->setRequestError(reqinfo, request, SNMP_NOSUCHINSTANCE);
+                    continue;
+                }
+            }
+
+            /* Convert from Qt to SNMP data */
+            if(!writeVarValue(column->type, varbind, v))
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_GENERR);
+                continue;
+            }
+            if(log)
+                this->logCellValue(QSNMPLogType_GET, "SNMP-GET: ", table, column->fieldId, index, v);
+        }
+        return SNMP_ERR_NOERROR;
+    }
+
+    /* SET requests, rows cannot be created */
+    for(netsnmp_request_info * request = requests; request; request = request->next)
+    {
+        netsnmp_variable_list * varbind = request->requestvb;
+        const QSNMPTableColumn * column = nullptr;
+        quint32 fieldId = 0;
+        QSNMPOid index;
+        if(splitCellOid(table, varbind->name, varbind->name_length, &fieldId, &index))
+            column = table->snmpColumn(fieldId);
+        QHash<void *, PendingSet>::iterator it = mPendingSets.find(request);
+        switch(reqinfo->mode)
+        {
+        case MODE_SET_RESERVE1:
+        {
+            /* Check access and row, then convert from SNMP to Qt data */
+            if(!column || (column->maxAccess < QSNMPMaxAccess_ReadWrite))
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_NOTWRITABLE);
+                break;
+            }
+            PendingSet pendingSet;
+            pendingSet.oldValue = table->snmpGetCell(index, fieldId);
+            if(!pendingSet.oldValue.isValid())
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_NOCREATION);
+                break;
+            }
+            int rc = readVarbindValue(column->type, varbind, pendingSet.value);
+            if(rc != SNMP_ERR_NOERROR)
+            {
+                this->setRequestError(reqinfo, request, rc);
+                break;
+            }
+            pendingSet.applied = false;
+            mPendingSets.insert(request, pendingSet);
+            break;
         }
-        case QSNMPType_Opaque: /* QByteArray */
+        case MODE_SET_RESERVE2:
+            break;
+        case MODE_SET_ACTION:
         {
-            if(netsnmp_varlist->type != ASN_OPAQUE)
-                validType = false;
-            QByteArray ba = QByteArray((const char*)netsnmp_varlist->val.string, netsnmp_varlist->val_len);
-            v.setValue<QByteArray>(ba);
+            if(!column || (it == mPendingSets.end()))
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_GENERR);
+                break;
+            }
+
+            /* Write value to user application */
+            if(this->logEnabled(QSNMPLogType_SET))
+                this->logCellValue(QSNMPLogType_SET, "SNMP-SET: ", table, fieldId, index, it->value);
+            if(!table->snmpSetCell(index, fieldId, it->value))
+            {
+                this->setRequestError(reqinfo, request, SNMP_ERR_BADVALUE);
+                break;
+            }
+            it->applied = true;
             break;
         }
-        case QSNMPType_ObjectId: /* QSNMPOid */
+        case MODE_SET_UNDO:
         {
-            if(netsnmp_varlist->type != ASN_OBJECT_ID)
-                validType = false;
-            QSNMPOid qtOid = convertOidSnmpToQt(netsnmp_varlist->val.objid, netsnmp_varlist->val_len/sizeof(oid));
-            v.setValue<QSNMPOid>(qtOid);
+            if(column && (it != mPendingSets.end()) && it->applied && !table->snmpSetCell(index, fieldId, it->oldValue))
+                this->setRequestError(reqinfo, request, SNMP_ERR_UNDOFAILED);
+            mPendingSets.remove(request);
+            break;
+        }
+        case MODE_SET_COMMIT:
+        case MODE_SET_FREE:
+            mPendingSets.remove(request);
             break;
+        default:
+            break;
+        }
+    }
+    return SNMP_ERR_NOERROR;
+}
+
+/* Reads the values of pending GET requests [first, last), which all belong to the same module, from the
+ * user application: direct values first for a module called on its own thread ('queued'), then delegated
+ * ones (see QSNMPModule::snmpGetValueAsync), then all the remaining ones with a single snmpGetValues call.
+ * A 'queued' module's variables are looked up again from the request OIDs, since the variable map was
+ * unlocked while waiting for the module's thread.
+ * Returns false if a value could not be converted. */
+bool QSNMPAgent::readValues(void * _handler, void * _reginfo, void * _reqinfo, QVector<PendingGet> & pendingGets,
+                            int first, int last, bool log, bool queued)
+{
+    netsnmp_mib_handler * handler = (netsnmp_mib_handler *)_handler;
+    netsnmp_handler_registration * reginfo = (netsnmp_handler_registration *)_reginfo;
+    netsnmp_agent_request_info * reqinfo = (netsnmp_agent_request_info * )_reqinfo;
+    QSNMPModule * module = pendingGets[first].module;
+    QSNMPVarList vars;
+    for(int k=first; k<last; k++)
+    {
+        PendingGet & pendingGet = pendingGets[k];
+        if(queued)
+        {
+            netsnmp_variable_list * varbind = pendingGet.request->requestvb;
+            pendingGet.var = mVarMap.find(varbind->name, varbind->name_length);
+            if(!pendingGet.var || (pendingGet.var->module() != module))
+            {
+                pendingGet.var = nullptr;
+                this->setRequestError(reqinfo, pendingGet.request, SNMP_NOSUCHINSTANCE);
+                continue;
+            }
+            QVariant v;
+            quint32 cacheGeneration = pendingGet.var->cacheGeneration();
+            if(readVarValueDirect(pendingGet.var, varbind, log ? &v : nullptr))
+            {
+                cacheVarValue(pendingGet.var, varbind, cacheGeneration);
+                if(log)
+                    this->logVarValue(QSNMPLogType_GET, "SNMP-GET: ", pendingGet.var, v);
+                pendingGet.var = nullptr;
+                continue;
+            }
+        }
+
+        /* Delegated request (if enabled for the module), answered later on by completeRequest, which the module
+         * may also call before snmpGetValueAsync returns: the request is thus delegated beforehand, and restored
+         * if declined. The cache generation is kept along with the request (as its local information). */
+        pendingGet.cacheGeneration = pendingGet.var->cacheGeneration();
+        if(!module->snmpAsync())
+        {
+            vars << pendingGet.var;
+            continue;
+        }
+        netsnmp_delegated_cache * cache = netsnmp_create_delegated_cache(handler, reginfo, reqinfo, pendingGet.request,
+                                                                         (void *)(quintptr)pendingGet.cacheGeneration);
+        if(!cache)
+            return false;
+        QSNMPRequestToken token = mNextRequestToken++;
+        pendingGet.request->delegated = 1;
+        mDelegatedGets.insert(token, cache);
+        if(pendingGet.module->snmpGetValueAsync(pendingGet.var, token))
+        {
+            pendingGet.var = nullptr;
+            continue;
+        }
+        if(mDelegatedGets.remove(token))
+        {
+            pendingGet.request->delegated = 0;
+            netsnmp_free_delegated_cache(cache);
         }
-        case QSNMPType_TimeTicks: /* quint32 */
+        vars << pendingGet.var;
+    }
+    if(vars.isEmpty())
+        return true;
+    QVector<QVariant> values;
+    module->snmpGetValues(vars, values);
+
+    /* Convert from Qt to SNMP data */
+    for(int k=first, i=0; k<last; k++)
+    {
+        const PendingGet & pendingGet = pendingGets[k];
+        if(!pendingGet.var)
+            continue;
+        const QVariant & v = (i < values.size()) ? values[i] : QVariant();
+        i++;
+        if(!writeVarValue(pendingGet.var->type(), pendingGet.request->requestvb, v))
+            return false;
+        cacheVarValue(pendingGet.var, pendingGet.request->requestvb, pendingGet.cacheGeneration);
+        if(log)
+            this->logVarValue(QSNMPLogType_GET, "SNMP-GET: ", pendingGet.var, v);
+    }
+    return true;
+}
+
+/* Answers a delegated GET request (see QSNMPModule::snmpGetValueAsync) with the variable's value, which
+ * must be of the variable's type, or with an error if the value is invalid. The SNMP response is sent
+ * once all the delegated requests of the same SNMP message are answered.
+ * This function can be called from any thread, in which case the value is handed over to the agent thread.
+ * Returns false if the token is unknown, or if the request has expired (master agent timeout). */
+bool QSNMPAgent::completeRequest(QSNMPRequestToken token, const QVariant & v)
+{
+    /* Net-SNMP library is only used from the agent thread */
+    if(QThread::currentThread() != this->thread())
+    {
+        QMetaObject::invokeMethod(this, [this, token, v]()
         {
-            if(netsnmp_varlist->type != ASN_TIMETICKS)
-                validType = false;
-            quint32 value = *((quint32*)netsnmp_varlist->val.integer);
-            v.setValue<quint32>(value);
-            break;
-        }
-        case QSNMPType_Gauge: /* quint32 */
+            this->completeRequest(token, v);
+        }, Qt::QueuedConnection);
+        return true;
+    }
+
+    /* Get the request back, if still in progress */
+    netsnmp_delegated_cache * cache = (netsnmp_delegated_cache *)mDelegatedGets.take(token);
+    if(!cache)
+        return false;
+    netsnmp_delegated_cache * checkedCache = netsnmp_handler_check_cache(cache);
+    if(!checkedCache)
+    {
+        netsnmp_free_delegated_cache(cache);
+        return false;
+    }
+
+    /* Convert from Qt to SNMP data, the variable may have been deleted in the meantime */
+    netsnmp_request_info * request = checkedCache->requests;
+    netsnmp_variable_list * varbind = request->requestvb;
+    request->delegated = 0;
+    {
+        QMutexLocker locker(&mVarMapLock);
+        QSNMPVar * var = mVarMap.find(varbind->name, varbind->name_length);
+        if(!var)
+            this->setRequestError(checkedCache->reqinfo, request, SNMP_NOSUCHINSTANCE);
+        else if(!v.isValid() || !writeVarValue(var->type(), varbind, v))
+            this->setRequestError(checkedCache->reqinfo, request, SNMP_ERR_GENERR);
+        else
         {
-            if(netsnmp_varlist->type != ASN_GAUGE)
-                validType = false;
-            quint32 value = *((quint32*)netsnmp_varlist->val.integer);
-            v.setValue<quint32>(value);
-            break;
+            cacheVarValue(var, varbind, (quint32)(quintptr)checkedCache->localinfo);
+            if(this->logEnabled(QSNMPLogType_GET))
+                this->logVarValue(QSNMPLogType_GET, "SNMP-GET: ", var, v);
         }
-        case QSNMPType_Counter: /* quint32 */
+    }
+    netsnmp_free_delegated_cache(checkedCache);
+
+    /* Send the response if this was the last delegated request of the SNMP message. When completed from
+     * within snmpGetValueAsync, the handler is still running: the library is then processed once it returned,
+     * so that queued requests are not dispatched to the handler while this one is half-processed */
+    if(mHandlerDepth > 0)
+    {
+        QMetaObject::invokeMethod(this, [this]()
         {
-            if(netsnmp_varlist->type != ASN_COUNTER)
-                validType = false;
-            quint32 value = *((quint32*)netsnmp_varlist->val.integer);
-            v.setValue<quint32>(value);
-            break;
-        }
-        case QSNMPType_IpAddress: /* quint32 */
+            this->processLibrary();
+        }, Qt::QueuedConnection);
+    }
+    else
+        this->processLibrary();
+    return true;
+}
+
+/* Answers a delegated GET request (see QSNMPModule::snmpGetValueAsync) with the result of 'future'
+ * once it finishes, or with an error if it is canceled. This function can be called from any thread. */
+void QSNMPAgent::completeRequest(QSNMPRequestToken token, const QFuture<QVariant> & future)
+{
+    /* The watcher lives in the agent thread */
+    if(QThread::currentThread() != this->thread())
+    {
+        QMetaObject::invokeMethod(this, [this, token, future]()
         {
-            if(netsnmp_varlist->type != ASN_IPADDRESS)
-                validType = false;
-            quint8 * ip = netsnmp_varlist->val.string;
-            quint32 value = ((quint32)ip[0] << 24) | ((quint32)ip[1] << 16) | ((quint32)ip[2] << 8) | ((quint32)ip[3] << 0);
-            v.setValue<quint32>(value);
-            break;
-        }
-        case QSNMPType_Counter64: /* quint64 */
+            this->completeRequest(token, future);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    QFutureWatcher<QVariant> * watcher = new QFutureWatcher<QVariant>(this);
+    connect(watcher, &QFutureWatcher<QVariant>::finished, this, [this, token, watcher]()
+    {
+        this->completeRequest(token, watcher->isCanceled() ? QVariant() : watcher->result());
+        watcher->deleteLater();
+    });
+    watcher->setFuture(future);
+}
+
+/* Calls 'function' (which uses a module's or table's callbacks) from the agent thread, either directly if 'context'
+ * is null, or on the thread of 'context' with a blocking queued call (see QSNMPModule::snmpSetCallContext).
+ * In the latter case, the variable map is unlocked while waiting, and locked on the module's thread while
+ * 'function' runs. The call is cancelled if it did not start after moduleCallTimeoutMs, or if the agent
+ * thread is being stopped, so that a busy or blocked module thread cannot block the agent thread.
+ * It is cancelled right away if 'context' is deleted, since its pending calls are then discarded.
+ * Returns false if the call was cancelled. */
+bool QSNMPAgent::callModule(QObject * context, QMutexLocker & locker, const std::function<void()> & function)
+{
+    if(!context)
+    {
+        function();
+        return true;
+    }
+
+    /* Post the call, it only references this thread's stack while it is running */
+    QSharedPointer<ModuleCall> call(new ModuleCall);
+    call->state = 0;
+    QPointer<QObject> guard(context);
+    QSNMPRecursiveMutex * lock = &mVarMapLock;
+    const std::function<void()> * f = &function;
+    locker.unlock();
+    QMetaObject::invokeMethod(context, [call, lock, f]()
+    {
+        if(!call->state.testAndSetOrdered(0, 1))
+            return;
         {
-            if(netsnmp_varlist->type != ASN_COUNTER64)
-                validType = false;
-            quint64 value = ((quint64)netsnmp_varlist->val.counter64->high << 32) | (quint64)netsnmp_varlist->val.counter64->low;
-            v.setValue<quint64>(value);
-            break;
-        }
-        case QSNMPType_Null:
-            return SNMP_ERR_GENERR;
-        default:
-            return SNMP_ERR_GENERR;
+            QMutexLocker locker(lock);
+            (*f)();
         }
+        call->done.release();
+    }, Qt::QueuedConnection);
 
-        /* Write value to user application */
-        if(validType)
+    /* Wait for the call to complete, or cancel it */
+    QElapsedTimer timer;
+    timer.start();
+    bool done = true;
+    while(!call->done.tryAcquire(1, 10))
+    {
+        if(((timer.elapsed() >= moduleCallTimeoutMs) || mStopping.loadAcquire() || guard.isNull())
+           && call->state.testAndSetOrdered(0, -1))
         {
-            emit this->newLog(QSNMPLogType_SET,
-                              QString("SNMP-SET: %1 [%2] : %4 = %5").arg(var->fullName())
-                                                                    .arg(toString(var->maxAccess()))
-                                                                    .arg(toString(var->type()))
-                                                                    .arg(v.toString()));
-            if(!var->set(v))
-                netsnmp_set_request_error(reqinfo, requests, SNMP_ERR_BADVALUE);
+            done = false;
+            break;
         }
-        else
-            netsnmp_set_request_error(reqinfo, requests, SNMP_ERR_GENERR);
     }
+    locker.relock();
+    return done;
+}
 
-    /* Done */
-    return SNMP_ERR_NOERROR;
+/* Returns true if logs of the given type are emitted, that is if that type is enabled in the log mask
+ * and the newLog signal is connected. Log messages are only formatted when this returns true, so that
+ * logging costs nothing on the request path when nobody is listening or the log type is filtered. */
+bool QSNMPAgent::logEnabled(QSNMPLogType_e logType) const
+{
+    static const QMetaMethod newLogSignal = QMetaMethod::fromSignal(&QSNMPAgent::newLog);
+    return (mLogMask.loadAcquire() & qsnmpLogMask(logType)) && this->isSignalConnected(newLogSignal);
+}
+
+/* Enables or disables the logs of the given type. */
+void QSNMPAgent::setLogEnabled(QSNMPLogType_e logType, bool enabled)
+{
+    if(enabled)
+        mLogMask.fetchAndOrOrdered(qsnmpLogMask(logType));
+    else
+        mLogMask.fetchAndAndOrdered(~qsnmpLogMask(logType));
+}
+
+/* Returns the mask of enabled log types, a combination of qsnmpLogMask(logType) bits. */
+quint32 QSNMPAgent::logMask() const
+{
+    return mLogMask.loadAcquire();
+}
+
+/* Sets the mask of enabled log types, a combination of qsnmpLogMask(logType) bits
+ * (all log types are enabled by default, i.e. qsnmpLogMaskAll). */
+void QSNMPAgent::setLogMask(quint32 mask)
+{
+    mLogMask.storeRelease(mask);
+}
+
+/* Emits a log message with a variable's value. */
+void QSNMPAgent::logVarValue(QSNMPLogType_e logType, const char * prefix, const QSNMPVar * var, const QVariant & v)
+{
+    emit this->newLog(logType,
+                      QString("%1%2 [%3] : %4 = %5").arg(prefix)
+                                                    .arg(var->fullName())
+                                                    .arg(toString(var->maxAccess()))
+                                                    .arg(toString(var->type()))
+                                                    .arg(v.toString()));
+}
+
+/* Emits a log message with a table cell's value. */
+void QSNMPAgent::logCellValue(QSNMPLogType_e logType, const char * prefix, const QSNMPTable * table,
+                              quint32 fieldId, const QSNMPOid & index, const QVariant & v)
+{
+    const QSNMPTableColumn * column = table->snmpColumn(fieldId);
+    if(!column)
+        return;
+    emit this->newLog(logType,
+                      QString("%1%2%3 [%4] : %5 = %6").arg(prefix)
+                                                      .arg(column->name)
+                                                      .arg(toString(index))
+                                                      .arg(toString(column->maxAccess))
+                                                      .arg(toString(column->type))
+                                                      .arg(v.toString()));
 }
 
 /* Returns true if SNMP traps are enabled. */
@@ -530,144 +2664,597 @@ void QSNMPAgent::sendTrap(const QString & name, const QSNMPOid & groupOid, quint
  * The 'groupOid' is the OID of the parent group, 'fieldId' is the trap's identifier
  * under the parent group, so that 'groupOid.fieldId' form the NOTIFICATION-TYPE
  * identifier.
- * Multiple variable bindings can be added to the trap payload via the varList argument. */
+ * Multiple variable bindings can be added to the trap payload via the varList argument.
+ * Variables' values are read on the calling thread, the trap itself is sent by the agent thread. */
 void QSNMPAgent::sendTrap(const QString & name, const QSNMPOid & groupOid, quint32 fieldId, const QSNMPVarList & varList)
 {
     /* Return immediately if traps are disabled */
     if(!mTrapsEnabled)
         return;
 
-    /* Variables binding */
-    netsnmp_variable_list * snmpVarList = nullptr;
+    /* Variables binding, values are read right away */
+    bool log = this->logEnabled(QSNMPLogType_TRAP);
+    QSNMPOid trapOid = QSNMPOid() << groupOid << fieldId;
+    QVector<QVariant> values;
+    netsnmp_variable_list * snmpVarList = buildTrapVarbinds(trapOid, varList, log ? &values : nullptr);
+    if(!snmpVarList)
+    {
+        if(log)
+            emit this->newLog(QSNMPLogType_TRAP, QString("Could not send SNMP trap %1: OID longer than %2 arcs")
+                                                         .arg(name).arg(MAX_OID_LEN));
+        return;
+    }
+    this->dispatchTrap(name, trapOid, varList, snmpVarList, values, log);
+}
 
-    /* snmpTrapOID.0 */
-    static oid snmpTrapOid[] = { 1, 3, 6, 1, 6, 3, 1, 1, 4, 1, 0 };
-    oid trapOid[32];
-    size_t trapOidLen;
-    convertOidQtToSnmp(QSNMPOid() << groupOid << fieldId, trapOid, &trapOidLen, 32);
-    snmp_varlist_add_variable(&snmpVarList, snmpTrapOid, sizeof(snmpTrapOid)/sizeof(oid),
-                              ASN_OBJECT_ID, trapOid, trapOidLen*sizeof(oid));
+/* Sends a SNMP trap from a pre-encoded trap template, see QSNMPTrap.
+ * The variables' values are refreshed into the template's variable bindings, which are sent as is
+ * when possible (from the agent thread, with the trap queue disabled), or copied otherwise.
+ * The template may be sent from several threads at once, its variable bindings are thus locked
+ * until they are sent or copied. */
+void QSNMPAgent::sendTrap(const QSNMPTrap & trap)
+{
+    /* Return immediately if traps are disabled */
+    if(!mTrapsEnabled)
+        return;
 
-    /* Log */
-    emit this->newLog(QSNMPLogType_TRAP,
-                      QString("SNMP-TRAP: %1").arg(name));
+    /* Refresh values into the template's variable bindings, after snmpTrapOID.0 */
+    bool log = this->logEnabled(QSNMPLogType_TRAP);
+    QVector<QVariant> values;
+    netsnmp_variable_list * snmpVarList = (netsnmp_variable_list *)trap.varbinds();
+    if(!snmpVarList)
+    {
+        if(log)
+            emit this->newLog(QSNMPLogType_TRAP, QString("Could not send SNMP trap %1: OID longer than %2 arcs")
+                                                         .arg(trap.name()).arg(MAX_OID_LEN));
+        return;
+    }
+    QMutexLocker varbindsLocker(trap.varbindsLock());
+    netsnmp_variable_list * varbind = snmpVarList->next_variable;
+    foreach(QSNMPVar * var, trap.varList())
+    {
+        QVariant v;
+        readVarValue(var, varbind, log ? &v : nullptr);
+        if(log)
+            values << v;
+        varbind = varbind->next_variable;
+    }
 
-    /* Variables bindings */
-    foreach(QSNMPVar * var, varList)
+    /* Send in place, without any allocation */
+    if(QThread::currentThread() == this->thread())
     {
-        if(var)
+        QMutexLocker locker(&mTrapLock);
+        if((mTrapCoalescingMs == 0) && (mTrapRate == 0))
         {
-            /* Variable OID */
-            oid varOid[32];
-            size_t varOidLen;
-            convertOidQtToSnmp(var->oid(), varOid, &varOidLen, 32);
+            mTrapsSent++;
+            locker.unlock();
+            send_v2trap(snmpVarList);
+            varbindsLocker.unlock();
+            if(log)
+                this->logTrap(trap.name(), trap.varList(), values);
+            return;
+        }
+    }
+    netsnmp_variable_list * snmpVarListCopy = snmp_clone_varbind(snmpVarList);
+    varbindsLocker.unlock();
+    this->dispatchTrap(trap.name(), trap.trapOid(), trap.varList(), snmpVarListCopy, values, log);
+}
 
-            /* Read value from user application */
-            QVariant v = var->get();
-            emit this->newLog(QSNMPLogType_TRAP,
-                              QString("           => %1 [%2] : %4 = %5").arg(var->fullName())
-                                                                        .arg(toString(var->maxAccess()))
-                                                                        .arg(toString(var->type()))
-                                                                        .arg(v.toString()));
+/* Coalesces, rate-limits, logs and sends (or queues) a trap's variable bindings, which are then owned
+ * by the agent. */
+void QSNMPAgent::dispatchTrap(const QString & name, const QSNMPOid & trapOid, const QSNMPVarList & varList,
+                              void * varbinds, const QVector<QVariant> & values, bool log)
+{
+    netsnmp_variable_list * snmpVarList = (netsnmp_variable_list *)varbinds;
 
-            /* Convert from Qt to SNMP data */
-            switch(var->type())
-            {
-            case QSNMPType_Integer: /* qint32 */
-            {
-                qint32 value = v.value<qint32>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_INTEGER, &value, 4);
-                break;
-            }
-            case QSNMPType_OctetStr: /* QString */
-            {
-                QByteArray byteArray = v.value<QString>().toUtf8();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_OCTET_STR, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_BitStr: /* QString */
-            {
-                QByteArray byteArray = v.value<QString>().toUtf8();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_BIT_STR, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_Opaque: /* QByteArray */
-            {
-                QByteArray byteArray = v.value<QByteArray>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_OPAQUE, byteArray.constData(), byteArray.size());
-                break;
-            }
-            case QSNMPType_ObjectId: /* QSNMPOid */
-            {
-                QSNMPOid qtOid = v.value<QSNMPOid>();
-                oid snmpOid[32];
-                size_t snmpOidLen;
-                convertOidQtToSnmp(qtOid, snmpOid, &snmpOidLen, 32);
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_OBJECT_ID, snmpOid, snmpOidLen*sizeof(oid));
-                break;
-            }
-            case QSNMPType_TimeTicks: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_TIMETICKS, &value, 4);
-                break;
-            }
-            case QSNMPType_Gauge: /* quint32 */
+    /* Coalesce or rate-limit the trap, if the trap queue is enabled */
+    bool queued = false;
+    {
+        QMutexLocker locker(&mTrapLock);
+        if((mTrapCoalescingMs > 0) || (mTrapRate > 0))
+        {
+            /* Identical traps (same trap OID and variables) still in the queue are replaced, with the latest values */
+            QSNMPOid key;
+            if(mTrapCoalescingMs > 0)
             {
-                quint32 value = v.value<quint32>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_GAUGE, &value, 4);
-                break;
+                key = trapOid;
+                foreach(QSNMPVar * var, varList)
+                {
+                    if(var)
+                        key << var->oid().size() << var->oid();
+                }
+                QHash<QSNMPOid, quint64>::const_iterator it = mTrapQueueKeys.constFind(key);
+                if(it != mTrapQueueKeys.constEnd())
+                {
+                    QueuedTrap & trap = mTrapQueue[it.value()];
+                    snmp_free_varbind((netsnmp_variable_list *)trap.varbinds);
+                    trap.varbinds = snmpVarList;
+                    mTrapsSuppressed++;
+                    return;
+                }
             }
-            case QSNMPType_Counter: /* quint32 */
+
+            /* Rate limit per trap OID (token bucket) */
+            if(mTrapRate > 0)
             {
-                quint32 value = v.value<quint32>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_COUNTER, &value, 4);
-                break;
-            }
-            case QSNMPType_IpAddress: /* quint32 */
-            {
-                quint32 value = v.value<quint32>();
-                quint8 ip[4];
-                ip[0] = (value >> 24) & 0xFF;
-                ip[1] = (value >> 16) & 0xFF;
-                ip[2] = (value >> 8) & 0xFF;
-                ip[3] = (value >> 0) & 0xFF;
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_IPADDRESS, ip, 4);
-                break;
+                qint64 now = clockMs();
+                QHash<QSNMPOid, TrapBucket>::iterator bucket = mTrapBuckets.find(trapOid);
+                if(bucket == mTrapBuckets.end())
+                {
+                    TrapBucket newBucket;
+                    newBucket.tokens = mTrapBurst;
+                    newBucket.timeMs = now;
+                    bucket = mTrapBuckets.insert(trapOid, newBucket);
+                }
+                bucket->tokens = qMin((double)mTrapBurst, bucket->tokens + (now - bucket->timeMs) * mTrapRate / 1000.0);
+                bucket->timeMs = now;
+                if(bucket->tokens < 1.0)
+                {
+                    snmp_free_varbind(snmpVarList);
+                    mTrapsDropped++;
+                    return;
+                }
+                bucket->tokens -= 1.0;
             }
-            case QSNMPType_Counter64: /* quint64 */
+
+            /* Queue, to be sent by the agent thread at the end of the coalescing window */
+            QueuedTrap trap;
+            trap.key = key;
+            trap.dueMs = clockMs() + mTrapCoalescingMs;
+            trap.varbinds = snmpVarList;
+            if(mTrapCoalescingMs > 0)
+                mTrapQueueKeys.insert(key, mTrapSeq);
+            mTrapQueue.insert(mTrapSeq++, trap);
+            if(mTrapQueue.size() == 1)
+                QMetaObject::invokeMethod(this, "flushTraps", Qt::QueuedConnection);
+            queued = true;
+        }
+    }
+
+    /* Log */
+    if(log)
+        this->logTrap(name, varList, values);
+
+    /* Send trap upstream and clean up, Net-SNMP library is only used from the agent thread */
+    if(queued)
+        return;
+    if(QThread::currentThread() == this->thread())
+        this->sendTrapVarbinds(snmpVarList);
+    else
+    {
+        QMetaObject::invokeMethod(this, [this, snmpVarList]()
+        {
+            this->sendTrapVarbinds(snmpVarList);
+        }, Qt::QueuedConnection);
+    }
+}
+
+/* Emits the log messages of a trap, with its variables' values. */
+void QSNMPAgent::logTrap(const QString & name, const QSNMPVarList & varList, const QVector<QVariant> & values)
+{
+    emit this->newLog(QSNMPLogType_TRAP,
+                      QString("SNMP-TRAP: %1").arg(name));
+    int k = 0;
+    foreach(QSNMPVar * var, varList)
+    {
+        if(var && (var->type() < QSNMPType_Null))
+            this->logVarValue(QSNMPLogType_TRAP, "           => ", var, values.value(k++));
+    }
+}
+
+/* Sends a trap's variable bindings upstream and frees them, from the agent thread. */
+void QSNMPAgent::sendTrapVarbinds(void * varbinds)
+{
+    send_v2trap((netsnmp_variable_list *)varbinds);
+    snmp_free_varbind((netsnmp_variable_list *)varbinds);
+    QMutexLocker locker(&mTrapLock);
+    mTrapsSent++;
+}
+
+/* Sends the queued traps at the end of their coalescing window, from the agent thread,
+ * then waits for the next one. */
+void QSNMPAgent::flushTraps()
+{
+    QList<void *> varbindsList;
+    {
+        QMutexLocker locker(&mTrapLock);
+        qint64 now = clockMs();
+        while(!mTrapQueue.isEmpty() && (mTrapQueue.first().dueMs <= now))
+        {
+            QueuedTrap trap = mTrapQueue.take(mTrapQueue.firstKey());
+            mTrapQueueKeys.remove(trap.key);
+            varbindsList << trap.varbinds;
+        }
+        if(!mTrapQueue.isEmpty())
+            mTrapTimer->start((int)(mTrapQueue.first().dueMs - now));
+    }
+    foreach(void * varbinds, varbindsList)
+        this->sendTrapVarbinds(varbinds);
+}
+
+/* Returns the trap coalescing window, see setTrapCoalescing. */
+int QSNMPAgent::trapCoalescing() const
+{
+    QMutexLocker locker(&mTrapLock);
+    return mTrapCoalescingMs;
+}
+
+/* Sets the trap coalescing window, in milliseconds. When enabled, traps are queued and sent by the agent
+ * thread at the end of the window, and identical traps (same trap OID and variables, i.e. the same
+ * interface flapping) sent in the meantime only update the queued trap's values and count as suppressed.
+ * A window of 0 (default) disables coalescing. */
+void QSNMPAgent::setTrapCoalescing(int windowMs)
+{
+    QMutexLocker locker(&mTrapLock);
+    mTrapCoalescingMs = qMax(0, windowMs);
+}
+
+/* Returns the trap rate limit, in traps per second per trap OID (see setTrapRateLimit). */
+int QSNMPAgent::trapRateLimit() const
+{
+    QMutexLocker locker(&mTrapLock);
+    return mTrapRate;
+}
+
+/* Sets the trap rate limit (token bucket), in traps per second per trap OID, with bursts of up to 'burst'
+ * traps. When enabled, traps are queued and sent by the agent thread, and traps above the limit are dropped.
+ * A rate of 0 (default) disables rate limiting. */
+void QSNMPAgent::setTrapRateLimit(int trapsPerSecond, int burst)
+{
+    QMutexLocker locker(&mTrapLock);
+    mTrapRate = qMax(0, trapsPerSecond);
+    mTrapBurst = qMax(1, burst);
+    mTrapBuckets.clear();
+}
+
+/* Returns the number of traps sent upstream. */
+quint64 QSNMPAgent::trapsSent() const
+{
+    QMutexLocker locker(&mTrapLock);
+    return mTrapsSent;
+}
+
+/* Returns the number of traps suppressed by coalescing. */
+quint64 QSNMPAgent::trapsSuppressed() const
+{
+    QMutexLocker locker(&mTrapLock);
+    return mTrapsSuppressed;
+}
+
+/* Returns the number of traps dropped by rate limiting. */
+quint64 QSNMPAgent::trapsDropped() const
+{
+    QMutexLocker locker(&mTrapLock);
+    return mTrapsDropped;
+}
+
+/* Returns true if the self-monitoring statistics are enabled. */
+bool QSNMPAgent::statisticsEnabled() const
+{
+    return mStatsEnabled.load(std::memory_order_relaxed);
+}
+
+/* Enables or disables (default) the self-monitoring statistics: requests counters and handler latency,
+ * and time spent in each module's get callbacks. When enabled with a 'groupOid', the statistics are also
+ * exported as SNMP variables under that OID (see QSNMPStatsModule). Registration failures are always counted.
+ * The statistics are updated lock-free, but measuring times costs a few clock reads per request.
+ * The statistics module is read by the agent thread, so that it is only replaced from that thread:
+ * when called from another thread, the change is applied later on by the agent thread. */
+void QSNMPAgent::setStatisticsEnabled(bool enabled, const QSNMPOid & groupOid)
+{
+    if(QThread::currentThread() != this->thread())
+    {
+        QMetaObject::invokeMethod(this, [this, enabled, groupOid]()
+        {
+            this->setStatisticsEnabled(enabled, groupOid);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    delete mStatsModule;
+    mStatsModule = nullptr;
+    mStatsEnabled.store(enabled, std::memory_order_relaxed);
+    if(enabled && !groupOid.isEmpty())
+        mStatsModule = new QSNMPStatsModule(this, groupOid, &mStatsGetRequests, &mStatsGetNextRequests,
+                                            &mStatsSetRequests, &mStatsRequestErrors, &mStatsRegisterFailures);
+}
+
+/* Returns the number of GET requests (PDUs) processed while statistics are enabled. */
+quint64 QSNMPAgent::getRequests() const
+{
+    return mStatsGetRequests.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of GETNEXT (and GETBULK) requests (PDUs) processed while statistics are enabled. */
+quint64 QSNMPAgent::getNextRequests() const
+{
+    return mStatsGetNextRequests.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of SET requests (PDUs) processed while statistics are enabled. */
+quint64 QSNMPAgent::setRequests() const
+{
+    return mStatsSetRequests.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of requests (PDUs) with at least a varbind answered with an error (i.e. noSuchInstance,
+ * notWritable, wrongValue or genErr) while statistics are enabled. */
+quint64 QSNMPAgent::requestErrors() const
+{
+    return mStatsRequestErrors.load(std::memory_order_relaxed);
+}
+
+/* Returns the number of variables that could not be registered. */
+quint64 QSNMPAgent::registerFailures() const
+{
+    return mStatsRegisterFailures.load(std::memory_order_relaxed);
+}
+
+/* Returns the given percentile (i.e. 50 or 99) of the handler latency in microseconds, as the upper
+ * bound of the matching power of 2 histogram bucket, or 0 if no request was processed. */
+quint32 QSNMPAgent::handlerLatency(int percentile) const
+{
+    quint64 counts[latencyBuckets];
+    quint64 total = 0;
+    for(int k=0; k<latencyBuckets; k++)
+    {
+        counts[k] = mStatsLatency[k].load(std::memory_order_relaxed);
+        total += counts[k];
+    }
+    if(!total)
+        return 0;
+    quint64 target = (total*qBound(0, percentile, 100) + 99)/100;
+    quint64 cumulated = 0;
+    for(int k=0; k<latencyBuckets; k++)
+    {
+        cumulated += counts[k];
+        if(cumulated >= qMax(target, (quint64)1))
+            return (quint32)(1ull << k);
+    }
+    return 0xFFFFFFFF;
+}
+
+/* Sets the error status of a request, counted in the statistics when enabled. */
+void QSNMPAgent::setRequestError(void * reqinfo, void * request, int error)
+{
+    netsnmp_set_request_error((netsnmp_agent_request_info *)reqinfo, (netsnmp_request_info *)request, error);
+    if(mStatsEnabled.load(std::memory_order_relaxed))
+        this->recordRequestError(reqinfo);
+}
+
+/* Returns the transaction identifier of the PDU being processed, or 0 if unknown (i.e. handler called directly). */
+static long requestPdu(const netsnmp_agent_request_info * reqinfo)
+{
+    return (reqinfo->asp && reqinfo->asp->pdu) ? reqinfo->asp->pdu->transid : 0;
+}
+
+/* Counts a failed request, once per PDU however many of its varbinds failed. */
+void QSNMPAgent::recordRequestError(void * reqinfo)
+{
+    long pdu = requestPdu((netsnmp_agent_request_info *)reqinfo);
+    if(pdu && (pdu == mStatsLastErrorPdu))
+        return;
+    mStatsLastErrorPdu = pdu;
+    mStatsRequestErrors.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Records the statistics of a handler call, lasting 'nsecs' nanoseconds. The Net-SNMP library calls the
+ * handler once per registration of the PDU's varbinds (i.e. once per varbind in instance registration mode)
+ * and once per SET phase, so that requests are counted once per PDU, while the latency is per handler call.
+ * A handler failure without any request error set (see setRequestError) is counted as an error as well. */
+void QSNMPAgent::recordRequest(void * _reqinfo, qint64 nsecs, int rc)
+{
+    netsnmp_agent_request_info * reqinfo = (netsnmp_agent_request_info *)_reqinfo;
+    long pdu = requestPdu(reqinfo);
+    if(!pdu || (pdu != mStatsLastPdu))
+    {
+        switch(reqinfo->mode)
+        {
+        case MODE_GET:
+            mStatsGetRequests.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case MODE_GETNEXT:
+        case MODE_GETBULK:
+            mStatsGetNextRequests.fetch_add(1, std::memory_order_relaxed);
+            break;
+        case MODE_SET_RESERVE1:
+            mStatsSetRequests.fetch_add(1, std::memory_order_relaxed);
+            break;
+        default:
+            break;
+        }
+        mStatsLastPdu = pdu;
+    }
+    if(rc != SNMP_ERR_NOERROR)
+        this->recordRequestError(reqinfo);
+
+    /* Bucket k holds latencies up to 2^k microseconds */
+    quint64 usecs = (quint64)qMax(nsecs, (qint64)0)/1000;
+    int bucket = 0;
+    while(usecs && (bucket < latencyBuckets-1))
+    {
+        usecs >>= 1;
+        bucket++;
+    }
+    mStatsLatency[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+/* Returns the modules linked to this agent. */
+QList<QSNMPModule *> QSNMPAgent::modules() const
+{
+    QMutexLocker locker(&mVarMapLock);
+    return mModules;
+}
+
+/* Adds a module to the list of modules linked to this agent, with a new generation so that requests
+ * waiting for a module's thread can tell whether their module was deleted in the meantime (see handler). */
+void QSNMPAgent::addModule(QSNMPModule * module)
+{
+    QMutexLocker locker(&mVarMapLock);
+    mModules << module;
+    mModuleGenerations.insert(module, mNextModuleGeneration++);
+}
+
+/* Removes a module from the list of modules linked to this agent. */
+void QSNMPAgent::removeModule(QSNMPModule * module)
+{
+    QMutexLocker locker(&mVarMapLock);
+    mModules.removeOne(module);
+    mModuleGenerations.remove(module);
+}
+
+/* Returns the storage of the SNMP variables, shared by all the modules linked to this agent. */
+QSNMPPool * QSNMPAgent::varPool()
+{
+    return &mVarPool;
+}
+
+/* Returns the column descriptor for a new variable, with a reference taken for it: the variables of all
+ * modules created with the same attributes under the same column OID (groupOid.fieldId) share a single
+ * descriptor (i.e. the cells of a table made of a module per row). The agent keeps its own reference to
+ * the descriptors until they are no longer used by any variable (see releaseColumns). */
+QSNMPColumn * QSNMPAgent::acquireColumn(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                        const QSNMPOid & groupOid, quint32 fieldId)
+{
+    QSNMPOid columnOid = QSNMPOid() << groupOid << fieldId;
+    QMutexLocker locker(&mColumnsLock);
+    QList<QSNMPColumn *> & columns = mColumns[columnOid];
+    foreach(QSNMPColumn * column, columns)
+    {
+        if((column->name() == name) && (column->type() == type) && (column->maxAccess() == maxAccess))
+        {
+            column->ref();
+            return column;
+        }
+    }
+    QSNMPColumn * column = new QSNMPColumn(name, type, maxAccess, groupOid, fieldId);
+    column->ref();
+    columns << column;
+    return column;
+}
+
+/* Frees the column descriptors which are no longer used by any variable (called once a module is deleted).
+ * Descriptors are only referenced while the lock is held, so that a free one cannot be taken meanwhile. */
+void QSNMPAgent::releaseColumns()
+{
+    QMutexLocker locker(&mColumnsLock);
+    QHash<QSNMPOid, QList<QSNMPColumn *> >::iterator it = mColumns.begin();
+    while(it != mColumns.end())
+    {
+        QList<QSNMPColumn *> & columns = it.value();
+        for(int k=columns.size()-1; k>=0; k--)
+        {
+            if(!columns[k]->deref())
             {
-                quint64 value = v.value<quint64>();
-                snmp_varlist_add_variable(&snmpVarList, varOid, varOidLen,
-                                          ASN_COUNTER64, &value, 8);
-                break;
-            }
-            case QSNMPType_Null:
-                break;
-            default:
-                break;
+                delete columns[k];
+                columns.removeAt(k);
             }
+            else
+                columns[k]->ref();
         }
+        if(columns.isEmpty())
+            it = mColumns.erase(it);
+        else
+            ++it;
+    }
+}
+
+
+/* Returns the event processing mode. */
+QSNMPEventMode_e QSNMPAgent::eventMode() const
+{
+    return mEventMode;
+}
+
+/* Sets the event processing mode.
+ * In QSNMPEventMode_Polling mode (default), the Net-SNMP library is polled by a timer every 0 to 5 ms,
+ * depending on when the last SNMP packet was received.
+ * In QSNMPEventMode_SocketNotifier mode, the Net-SNMP sockets are watched by QSocketNotifier objects
+ * and the Net-SNMP library timeouts by a single-shot timer, so that the library is only processed when
+ * data is received or a timeout is due: there are no wake-ups while idle, and no polling latency. */
+void QSNMPAgent::setEventMode(QSNMPEventMode_e mode)
+{
+    /* Timers and socket notifiers are only used from the agent thread */
+    if(QThread::currentThread() != this->thread())
+    {
+        QMetaObject::invokeMethod(this, [this, mode]()
+        {
+            this->setEventMode(mode);
+        }, Qt::QueuedConnection);
+        return;
+    }
+    mEventMode = mode;
+    if(mEventMode == QSNMPEventMode_SocketNotifier)
+    {
+        mPollTimer->stop();
+        this->updateSocketNotifiers();
+    }
+    else
+    {
+        qDeleteAll(mSocketNotifiers);
+        mSocketNotifiers.clear();
+        mTimeoutTimer->stop();
+        mPollTimer->start(0);
+    }
+}
+
+/* Returns the threading mode. */
+QSNMPThreadMode_e QSNMPAgent::threadMode() const
+{
+    return mThreadMode;
+}
+
+/* Sets the threading mode, must be called from the thread that owns the agent.
+ * In QSNMPThreadMode_Caller mode (default), the agent runs on the thread that created it, along with
+ * the user application (i.e. the main thread), and calls the modules directly.
+ * In QSNMPThreadMode_Worker mode, the agent moves to its own thread and event loop, so that SNMP
+ * requests are processed independently from the busy application threads. The Net-SNMP library is then
+ * only used from that worker thread: variables created/deleted and traps sent from other threads are
+ * handed over to it. The modules are called from the worker thread, either directly (thread-safe
+ * modules), or on their own thread if they have a call context (see QSNMPModule::snmpSetCallContext). */
+void QSNMPAgent::setThreadMode(QSNMPThreadMode_e mode)
+{
+    if(mode == mThreadMode)
+        return;
+    mThreadMode = mode;
+    if(mThreadMode == QSNMPThreadMode_Worker)
+    {
+        mOwnerThread = QThread::currentThread();
+        mThread = new QThread();
+        mThread->setObjectName(QString("QSNMP %1").arg(mAgentName));
+        this->moveToThread(mThread);
+        mThread->start();
     }
+    else
+        this->stopThread();
+}
 
-    /* Send trap upstream and clean up */
-    send_v2trap(snmpVarList);
-    snmp_free_varbind(snmpVarList);
+/* Moves the agent back to its owner thread, and stops the worker thread.
+ * Module calls in progress are cancelled so that they cannot block on the owner thread. */
+void QSNMPAgent::stopThread()
+{
+    mStopping = 1;
+    QMetaObject::invokeMethod(this, "moveToOwnerThread", Qt::BlockingQueuedConnection);
+    mThread->quit();
+    mThread->wait();
+    delete mThread;
+    mThread = nullptr;
+    mOwnerThread = nullptr;
+    mStopping = 0;
 }
 
+/* Moves the agent (along with its timers and socket notifiers) to its owner thread, from the worker thread. */
+void QSNMPAgent::moveToOwnerThread()
+{
+    this->moveToThread(mOwnerThread);
+}
 
 /* Processes events received by the Net-SNMP library regularly. */
 void QSNMPAgent::processEvents()
 {
+    /* Timer polling mode only */
+    if(mEventMode != QSNMPEventMode_Polling)
+        return;
+
     /* Process incoming SNMP packets until no more packet is available.
      * If a packet was received, relaunch the timer (the timer indicates how much time
      * has elapsed since the last SNMP packet was received). */
@@ -681,7 +3268,81 @@ void QSNMPAgent::processEvents()
      * However wait time is increased if no packet was received recently, this reduces CPU
      * consumption (slower polling) in between NMS full updates. */
     int waitMs = qMin((qint64)5, mTimer.elapsed()/5);
-    QTimer::singleShot(waitMs, this, SLOT(processEvents()));
+    mPollTimer->start(waitMs);
+}
+
+/* Processes incoming data on a Net-SNMP socket (socket notifier mode). */
+void QSNMPAgent::processSocket(int socket)
+{
+    netsnmp_large_fd_set readfds;
+    netsnmp_large_fd_set_init(&readfds, qMax(socket+1, (int)FD_SETSIZE));
+    NETSNMP_LARGE_FD_ZERO(&readfds);
+    NETSNMP_LARGE_FD_SET(socket, &readfds);
+    snmp_read2(&readfds);
+    netsnmp_large_fd_set_cleanup(&readfds);
+    this->processLibrary();
+}
+
+/* Processes a Net-SNMP library timeout (socket notifier mode). */
+void QSNMPAgent::processTimeout()
+{
+    snmp_timeout();
+    this->processLibrary();
+}
+
+/* Runs the Net-SNMP library housekeeping that follows a read or timeout, the same way
+ * agent_check_and_process does, then watches the (possibly updated) sockets and timeout. */
+void QSNMPAgent::processLibrary()
+{
+    run_alarms();
+    netsnmp_check_outstanding_agent_requests();
+    if(mEventMode == QSNMPEventMode_SocketNotifier)
+        this->updateSocketNotifiers();
+}
+
+/* Watches the sockets and next timeout of the Net-SNMP library (socket notifier mode).
+ * Socket notifiers are kept across updates, and only created/deleted when the Net-SNMP
+ * sockets change (i.e. on master agent connection/disconnection). */
+void QSNMPAgent::updateSocketNotifiers()
+{
+    /* Get sockets and timeout from Net-SNMP library */
+    int numfds = 0;
+    int block = 1;
+    struct timeval timeout = { 0, 0 };
+    netsnmp_large_fd_set readfds;
+    netsnmp_large_fd_set_init(&readfds, FD_SETSIZE);
+    NETSNMP_LARGE_FD_ZERO(&readfds);
+    snmp_select_info2(&numfds, &readfds, &timeout, &block);
+
+    /* Watch sockets, reuse existing notifiers */
+    QMap<int, QSocketNotifier *> socketNotifiers;
+    for(int fd=0; fd<numfds; fd++)
+    {
+        if(!NETSNMP_LARGE_FD_ISSET(fd, &readfds))
+            continue;
+        QSocketNotifier * notifier = mSocketNotifiers.take(fd);
+        if(!notifier)
+        {
+            notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+            connect(notifier, SIGNAL(activated(int)), this, SLOT(processSocket(int)));
+        }
+        socketNotifiers.insert(fd, notifier);
+    }
+    netsnmp_large_fd_set_cleanup(&readfds);
+
+    /* Stop watching closed sockets, deferred because we may be called from one of those notifiers */
+    foreach(QSocketNotifier * notifier, mSocketNotifiers)
+    {
+        notifier->setEnabled(false);
+        notifier->deleteLater();
+    }
+    mSocketNotifiers = socketNotifiers;
+
+    /* Watch next timeout (rounded up to the next millisecond), if any */
+    if(!block)
+        mTimeoutTimer->start((int)(timeout.tv_sec*1000 + (timeout.tv_usec+999)/1000));
+    else
+        mTimeoutTimer->stop();
 }
 
 
@@ -699,12 +3360,33 @@ QSNMPModule::QSNMPModule(QSNMPAgent * snmpAgent)
 {
     mSnmpAgent = snmpAgent;
     mSnmpVarList.clear();
+    mSnmpVarHoles = 0;
+    mSnmpCallContext = nullptr;
+    mSnmpCacheTtl = 0;
+    mSnmpAsync = false;
+    mSnmpGetCalls = 0;
+    mSnmpGetNsecs = 0;
+    mSnmpGetMaxNsecs = 0;
+    mSnmpAgent->addModule(this);
 }
 
-/* Destructor for a SNMP module. Unregisters and deletes all SNMP variables. */
+/* Destructor for a SNMP module. Unregisters and deletes all SNMP variables, see snmpDetach.
+ * In QSNMPThreadMode_Worker mode, a module without call context is called from the agent thread until
+ * detached, while the user-derived class is already destroyed when this destructor runs: such a class
+ * must thus call snmpDetach first thing in its own destructor. */
 QSNMPModule::~QSNMPModule()
 {
+    this->snmpDetach();
+}
+
+/* Unlinks this module from the agent, so that requests waiting for this module's thread no longer call it,
+ * then unregisters and deletes all its SNMP variables: once returned, the module is no longer called by the
+ * agent, a callback in progress on the agent thread being waited for. No variable should be created afterwards. */
+void QSNMPModule::snmpDetach()
+{
+    mSnmpAgent->removeModule(this);
     this->snmpDeleteAllVars();
+    mSnmpAgent->releaseColumns();
 }
 
 /* Returns the linked SNMP agent. */
@@ -713,96 +3395,519 @@ QSNMPAgent * QSNMPModule::snmpAgent() const
     return mSnmpAgent;
 }
 
-/* Returns the list of SNMP variables allocated in this module. */
-const QSNMPVarList & QSNMPModule::snmpVarList() const
+/* Returns the list of SNMP variables allocated in this module, in creation order. */
+const QSNMPVarList & QSNMPModule::snmpVarList() const
+{
+    if(mSnmpVarHoles > 0)
+        this->snmpCompactVarList();
+    return mSnmpVarList;
+}
+
+/* Returns the first SNMP variable with given name from the list of
+ * SNMP variables allocated in this module, that is the earliest created one
+ * (variables of a table share the same name).
+ * Returns nullptr if none found. */
+QSNMPVar * QSNMPModule::snmpVar(const QString & name) const
+{
+    QHash<QString, NameEntry>::const_iterator it = mSnmpVarNames.constFind(name);
+    return (it != mSnmpVarNames.constEnd()) ? it.value().first : nullptr;
+}
+
+/* Returns the SNMP variable with given OID from the list of
+ * SNMP variables allocated in this module.
+ * Returns nullptr if none found. */
+QSNMPVar * QSNMPModule::snmpVar(const QSNMPOid & oid) const
+{
+    return mSnmpVarOids.value(oid);
+}
+
+/* Optional asynchronous getter, which can be implemented in the user-derived class for values that take
+ * time to get (i.e. an I/O round trip): return true to answer the GET request later on, by calling
+ * QSNMPAgent::completeRequest with the given token (from any thread), so that the agent keeps processing
+ * other requests in the meantime (possibly before this function returns). Each token must be completed,
+ * even if the request has expired. Return false (default) to get the value synchronously.
+ * Only called once enabled with snmpSetAsync. */
+bool QSNMPModule::snmpGetValueAsync(const QSNMPVar * var, QSNMPRequestToken token)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(token)
+    return false;
+}
+
+/* Returns true if snmpGetValueAsync is called for this module's GET requests, see snmpSetAsync. */
+bool QSNMPModule::snmpAsync() const
+{
+    return mSnmpAsync;
+}
+
+/* Enables or disables (default) the calls to snmpGetValueAsync for this module's GET requests. Setting up a
+ * delegated request has a cost (allocation, token), only paid by the modules that enable it. */
+void QSNMPModule::snmpSetAsync(bool async)
+{
+    mSnmpAsync = async;
+}
+
+/* Returns the time-to-live of this module's cached values, see snmpSetCacheTtl. */
+int QSNMPModule::snmpCacheTtl() const
+{
+    return mSnmpCacheTtl;
+}
+
+/* Sets the time-to-live (in milliseconds) of this module's cached values, for variables that do not
+ * have their own (see QSNMPVar::setCacheTtl). Values read from the user application to respond to GET
+ * requests are then cached, and served from that cache by the following GET requests until they expire,
+ * or until they are explicitly invalidated when the application knows that they changed.
+ * A time-to-live of 0 (default) disables the cache. */
+void QSNMPModule::snmpSetCacheTtl(int ttlMs)
+{
+    mSnmpCacheTtl = ttlMs;
+    this->snmpInvalidate();
+}
+
+/* Invalidates the cached values of all variables of this module. */
+void QSNMPModule::snmpInvalidate()
+{
+    foreach(QSNMPVar * var, this->snmpVarList())
+        var->invalidate();
+}
+
+/* Returns the object through which this module is called, see snmpSetCallContext. */
+QObject * QSNMPModule::snmpCallContext() const
+{
+    return mSnmpCallContext;
+}
+
+/* Sets the object through which this module is called when the agent runs on its own thread
+ * (QSNMPThreadMode_Worker): the module's callbacks (snmpGetValue, snmpSetValue, etc.) are then called
+ * on the thread of that object, with a blocking queued call from the agent thread. By default (nullptr),
+ * the callbacks are called directly from the agent thread, and must thus be thread-safe.
+ * The variables of a module with a call context must be created and deleted on that object's thread,
+ * and the object must outlive the module. */
+void QSNMPModule::snmpSetCallContext(QObject * context)
+{
+    mSnmpCallContext = context;
+}
+
+/* Returns a name for this module in the statistics: its class name for QObject-derived modules. */
+QString QSNMPModule::snmpModuleName() const
+{
+    const QObject * object = dynamic_cast<const QObject *>(this);
+    return object ? QString(object->metaObject()->className()) : QString("QSNMPModule");
+}
+
+/* Returns the number of calls to the get callbacks of this module, recorded while the agent statistics are enabled. */
+quint64 QSNMPModule::snmpGetCalls() const
+{
+    return mSnmpGetCalls.load(std::memory_order_relaxed);
+}
+
+/* Returns the total time spent in the get callbacks of this module, in microseconds. */
+quint64 QSNMPModule::snmpGetTime() const
+{
+    return mSnmpGetNsecs.load(std::memory_order_relaxed)/1000;
+}
+
+/* Returns the longest call to the get callbacks of this module, in microseconds. */
+quint64 QSNMPModule::snmpGetMaxTime() const
+{
+    return mSnmpGetMaxNsecs.load(std::memory_order_relaxed)/1000;
+}
+
+/* Records a call to the get callbacks of this module, lasting 'nsecs' nanoseconds. */
+void QSNMPModule::snmpRecordGet(qint64 nsecs)
+{
+    quint64 duration = (quint64)qMax(nsecs, (qint64)0);
+    mSnmpGetCalls.fetch_add(1, std::memory_order_relaxed);
+    mSnmpGetNsecs.fetch_add(duration, std::memory_order_relaxed);
+    quint64 max = mSnmpGetMaxNsecs.load(std::memory_order_relaxed);
+    while((duration > max) && !mSnmpGetMaxNsecs.compare_exchange_weak(max, duration, std::memory_order_relaxed));
+}
+
+/* Gets the values of several variables of this module at once, in order to respond to a SNMP request:
+ * the agent groups the variables of each request by module, so that a module can serve a whole set of
+ * variables (i.e. a GETBULK repetition over a table) with a single lock or pass over its data.
+ * 'values' must be filled with one value per variable, in the same order as 'vars'.
+ * The default implementation calls snmpGetValue for each variable. */
+void QSNMPModule::snmpGetValues(const QSNMPVarList & vars, QVector<QVariant> & values)
+{
+    values.reserve(vars.size());
+    foreach(const QSNMPVar * var, vars)
+        values << var->get();
+}
+
+/* Checks a value before it is set, during the first phase of a SET request (RESERVE1), so that
+ * a multi-variable SET request can be rejected before any variable is actually set.
+ * Return false to reject the value. The default implementation accepts any value. */
+bool QSNMPModule::snmpSetCheck(const QSNMPVar * var, const QVariant & v)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(v)
+    return true;
+}
+
+/* Called once all the variables of a SET request were successfully set (COMMIT), i.e. to apply
+ * values that depend on each other. The default implementation does nothing. */
+void QSNMPModule::snmpSetCommit(const QSNMPVar * var, const QVariant & v)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(v)
+}
+
+/* Restores the value a variable had before a SET request, when setting another variable of the same
+ * request failed (UNDO). Return false if the value could not be restored.
+ * The default implementation sets the previous value back via QSNMPVar set function. */
+bool QSNMPModule::snmpSetUndo(const QSNMPVar * var, const QVariant & oldValue)
+{
+    return var->set(oldValue);
+}
+
+/* Optional typed getter for QSNMPType_Integer variables, which can be implemented in the user-derived
+ * class to bypass the QVariant conversions of snmpGetValue. Returns true if 'value' was set, or false
+ * (default implementation) to fall back to snmpGetValue. */
+bool QSNMPModule::snmpGetInt32(const QSNMPVar * var, qint32 & value)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(value)
+    return false;
+}
+
+/* Optional typed getter for QSNMPType_TimeTicks, QSNMPType_Gauge, QSNMPType_Counter and QSNMPType_IpAddress
+ * variables, see snmpGetInt32. */
+bool QSNMPModule::snmpGetUInt32(const QSNMPVar * var, quint32 & value)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(value)
+    return false;
+}
+
+/* Optional typed getter for QSNMPType_Counter64 variables, see snmpGetInt32. */
+bool QSNMPModule::snmpGetUInt64(const QSNMPVar * var, quint64 & value)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(value)
+    return false;
+}
+
+/* Optional typed getter for QSNMPType_OctetStr, QSNMPType_BitStr (UTF-8) and QSNMPType_Opaque variables,
+ * which writes the value straight into 'buf' of capacity 'cap' bytes. Returns the number of bytes written,
+ * or -1 (default implementation, or if the value does not fit) to fall back to snmpGetValue. */
+int QSNMPModule::snmpGetBytes(const QSNMPVar * var, char * buf, size_t cap)
+{
+    Q_UNUSED(var)
+    Q_UNUSED(buf)
+    Q_UNUSED(cap)
+    return -1;
+}
+
+/* Creates a SNMP variable under this module and registers it with the agent.
+ * The 'name' argument can be any as desired by the user application, but it is recommended
+ * to use the same one as inside the MIB file to ease log parsing.
+ * The 'type' and 'maxAccess' arguments determine the data type and R/W permissions.
+ * The 'groupOid' is the OID of the parent group, 'fieldId' is the variable's identifier
+ * under the parent group, and 'indexes' can either be qsnmpScalarIndex (.0) for scalar
+ * variables or a list of values for tabular variables.
+ * The complete variable OID is thus 'groupOid.fieldId.indexes'.
+ * Returns the newly allocated variable, or nullptr on failure. */
+QSNMPVar * QSNMPModule::snmpCreateVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                         const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_None, nullptr, QSNMPValidator());
+}
+
+/* Creates a SNMP variable bound to a value in application memory, under this module, and registers
+ * it with the agent. The agent reads (and writes, for read-write variables) the pointed value directly,
+ * without calling snmpGetValue/snmpSetValue, so the pointed value must outlive the variable.
+ * The pointed type must match the variable's data type: qint32 for QSNMPType_Integer, quint32 for
+ * QSNMPType_TimeTicks, QSNMPType_Gauge, QSNMPType_Counter and QSNMPType_IpAddress, and quint64 for
+ * QSNMPType_Counter64, or their std::atomic counter-part if the value is updated from other threads.
+ * SET requests on read-write variables are accepted if the optional 'validator' returns true.
+ * See snmpCreateVar for the other arguments.
+ * Returns the newly allocated variable, or nullptr on failure. */
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, qint32 * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_Int32, value, validator);
+}
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, quint32 * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_UInt32, value, validator);
+}
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, quint64 * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_UInt64, value, validator);
+}
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, std::atomic<qint32> * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_AtomicInt32, value, validator);
+}
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, std::atomic<quint32> * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_AtomicUInt32, value, validator);
+}
+QSNMPVar * QSNMPModule::snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, std::atomic<quint64> * value,
+                                              const QSNMPOid & indexes, const QSNMPValidator & validator)
+{
+    return this->snmpCreateVar(name, type, maxAccess, groupOid, fieldId, indexes, QSNMPBinding_AtomicUInt64, value, validator);
+}
+
+/* Creates a SNMP variable, optionally bound to a value in application memory, under this module
+ * and registers it with the agent. Returns the newly allocated variable, or nullptr on failure. */
+QSNMPVar * QSNMPModule::snmpCreateVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                         const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes,
+                                         QSNMPBinding_e binding, void * value, const QSNMPValidator & validator)
+{
+    QSNMPVar * var = new (mSnmpAgent->varPool()->allocate()) QSNMPVar(this, mSnmpAgent->acquireColumn(name, type, maxAccess, groupOid, fieldId), indexes);
+    if(binding != QSNMPBinding_None)
+    {
+        /* Check that the bound value matches the variable's data type */
+        if(!isBindingCompatible(type, binding))
+        {
+            if(mSnmpAgent->logEnabled(QSNMPLogType_RegisterFail))
+                emit mSnmpAgent->newLog(QSNMPLogType_RegisterFail,
+                                        QString("Could not register SNMP variable %1: bound value does not match type %2")
+                                                .arg(var->fullName()).arg(toString(type)));
+            this->snmpFreeVar(var);
+            return nullptr;
+        }
+        var->setBinding(binding, value, validator);
+    }
+    if(!mSnmpAgent->registerVar(var))
+    {
+        this->snmpFreeVar(var);
+        return nullptr;
+    }
+    this->snmpIndexVar(var);
+    return var;
+}
+
+/* Adds a variable to the list of variables of this module, and to its name and OID indexes. */
+void QSNMPModule::snmpIndexVar(QSNMPVar * var)
+{
+    VarEntry entry;
+    entry.index = mSnmpVarList.size();
+    entry.prevSameName = nullptr;
+    entry.nextSameName = nullptr;
+    mSnmpVarList << var;
+
+    /* Variables sharing a name are chained in creation order */
+    QHash<QString, NameEntry>::iterator name = mSnmpVarNames.find(var->name());
+    if(name == mSnmpVarNames.end())
+    {
+        NameEntry nameEntry;
+        nameEntry.first = var;
+        nameEntry.last = var;
+        mSnmpVarNames.insert(var->name(), nameEntry);
+    }
+    else
+    {
+        entry.prevSameName = name->last;
+        mSnmpVarEntries[name->last].nextSameName = var;
+        name->last = var;
+    }
+    mSnmpVarEntries.insert(var, entry);
+    mSnmpVarOids.insert(var);
+}
+
+/* Destroys a variable allocated by this module, and gives its storage back to the agent's pool. */
+void QSNMPModule::snmpFreeVar(QSNMPVar * var)
+{
+    var->~QSNMPVar();
+    mSnmpAgent->varPool()->release(var);
+}
+
+/* Removes a variable from the list of variables of this module, and from its name and OID indexes,
+ * in (amortized) constant time: the variable leaves a hole in the list, so that the other ones keep their
+ * order, and the list is compacted once holes make up half of it.
+ * Returns false if the variable does not belong to this module. */
+bool QSNMPModule::snmpUnindexVar(QSNMPVar * var)
+{
+    QHash<QSNMPVar *, VarEntry>::iterator it = mSnmpVarEntries.find(var);
+    if(it == mSnmpVarEntries.end())
+        return false;
+    VarEntry entry = it.value();
+    mSnmpVarEntries.erase(it);
+
+    /* Leave a hole in the list, unless at its end */
+    if(entry.index == mSnmpVarList.size()-1)
+        mSnmpVarList.removeLast();
+    else
+    {
+        mSnmpVarList[entry.index] = nullptr;
+        if(++mSnmpVarHoles > mSnmpVarList.size()/2)
+            this->snmpCompactVarList();
+    }
+
+    /* Unchain from the variables sharing its name */
+    if(entry.prevSameName)
+        mSnmpVarEntries[entry.prevSameName].nextSameName = entry.nextSameName;
+    if(entry.nextSameName)
+        mSnmpVarEntries[entry.nextSameName].prevSameName = entry.prevSameName;
+    if(!entry.prevSameName && !entry.nextSameName)
+        mSnmpVarNames.remove(var->name());
+    else
+    {
+        NameEntry & name = mSnmpVarNames[var->name()];
+        if(name.first == var)
+            name.first = entry.nextSameName;
+        if(name.last == var)
+            name.last = entry.prevSameName;
+    }
+    mSnmpVarOids.remove(var);
+    return true;
+}
+
+/* Removes the holes left in the list of variables by deleted variables, keeping the order of the others. */
+void QSNMPModule::snmpCompactVarList() const
+{
+    int size = 0;
+    for(int k=0; k<mSnmpVarList.size(); k++)
+    {
+        QSNMPVar * var = mSnmpVarList[k];
+        if(!var)
+            continue;
+        if(size != k)
+        {
+            mSnmpVarList[size] = var;
+            mSnmpVarEntries[var].index = size;
+        }
+        size++;
+    }
+    mSnmpVarList.erase(mSnmpVarList.begin()+size, mSnmpVarList.end());
+    mSnmpVarHoles = 0;
+}
+
+/* Unregisters a variable (that was allocated in this module) from the agent, and frees it.
+ * Returns true on success. */
+bool QSNMPModule::snmpDeleteVar(QSNMPVar * var)
+{
+    if(!this->snmpUnindexVar(var))
+        return false;
+    mSnmpAgent->unregisterVar(var);
+    this->snmpFreeVar(var);
+    return true;
+}
+
+/* Unregisters several variables (that were allocated in this module, i.e. the rows of a table) from the
+ * agent at once, and frees them. Variables that do not belong to this module are ignored.
+ * Returns the number of deleted variables. */
+int QSNMPModule::snmpDeleteVars(const QSNMPVarList & varList)
+{
+    QSNMPVarList deleted;
+    deleted.reserve(varList.size());
+    foreach(QSNMPVar * var, varList)
+    {
+        if(this->snmpUnindexVar(var))
+            deleted << var;
+    }
+    mSnmpAgent->unregisterVars(deleted);
+    foreach(QSNMPVar * var, deleted)
+        this->snmpFreeVar(var);
+    return deleted.size();
+}
+
+/* Unregisters all variables (that were allocated in this module) from the agent at once, and frees them. */
+void QSNMPModule::snmpDeleteAllVars()
+{
+    QSNMPVarList varList;
+    this->snmpCompactVarList();
+    varList.swap(mSnmpVarList);
+    mSnmpVarEntries.clear();
+    mSnmpVarNames.clear();
+    mSnmpVarOids.clear();
+    mSnmpAgent->unregisterVars(varList);
+    foreach(QSNMPVar * var, varList)
+        this->snmpFreeVar(var);
+}
+
+
+
+/*******************************************************/
+/******************** SNMP VARIABLE ********************/
+/*******************************************************/
+
+/* Constructor for an SNMP column: the attributes shared by the variables of a column,
+ * see the QSNMPVar constructor for the arguments. The column starts with a reference
+ * held by its creator, and is freed along with its last reference (see ref/deref). */
+QSNMPColumn::QSNMPColumn(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                         const QSNMPOid & groupOid, quint32 fieldId)
+{
+    mName = name;
+    mType = type;
+    mMaxAccess = maxAccess;
+    mGroupOid = groupOid;
+    mFieldId = fieldId;
+    mOid = QSNMPOid() << groupOid << fieldId;
+    mRefCount = 1;
+}
+
+/* Returns the name of the column's variables. */
+const QString & QSNMPColumn::name() const
 {
-    return mSnmpVarList;
+    return mName;
 }
 
-/* Returns the first SNMP variable with given name from the list of
- * SNMP variables allocated in this module.
- * Returns nullptr if none found. */
-QSNMPVar * QSNMPModule::snmpVar(const QString & name) const
+/* Returns the data type of the column's variables. */
+QSNMPType_e QSNMPColumn::type() const
 {
-    foreach(QSNMPVar * var, mSnmpVarList)
-    {
-        if(var->name() == name)
-            return var;
-    }
-    return nullptr;
+    return mType;
 }
 
-/* Returns the first SNMP variable with given OID from the list of
- * SNMP variables allocated in this module.
- * Returns nullptr if none found. */
-QSNMPVar * QSNMPModule::snmpVar(const QSNMPOid & oid) const
+/* Returns the maximum access level of the column's variables. */
+QSNMPMaxAccess_e QSNMPColumn::maxAccess() const
 {
-    foreach(QSNMPVar * var, mSnmpVarList)
-    {
-        if(var->oid() == oid)
-            return var;
-    }
-    return nullptr;
+    return mMaxAccess;
 }
 
-/* Creates a SNMP variable under this module and registers it with the agent.
- * The 'name' argument can be any as desired by the user application, but it is recommended
- * to use the same one as inside the MIB file to ease log parsing.
- * The 'type' and 'maxAccess' arguments determine the data type and R/W permissions.
- * The 'groupOid' is the OID of the parent group, 'fieldId' is the variable's identifier
- * under the parent group, and 'indexes' can either be qsnmpScalarIndex (.0) for scalar
- * variables or a list of values for tabular variables.
- * The complete variable OID is thus 'groupOid.fieldId.indexes'.
- * Returns the newly allocated variable, or nullptr on failure. */
-QSNMPVar * QSNMPModule::snmpCreateVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
-                                         const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes)
+/* Returns the OID of the parent group. */
+const QSNMPOid & QSNMPColumn::groupOid() const
 {
-    QSNMPVar * var = new QSNMPVar(this, name, type, maxAccess, groupOid, fieldId, indexes);
-    if(!mSnmpAgent->registerVar(var))
-    {
-        delete var;
-        return nullptr;
-    }
-    mSnmpVarList << var;
-    return var;
+    return mGroupOid;
 }
 
-/* Unregisters a variable (that was allocated in this module) from the agent, and frees it.
- * Returns true on success. */
-bool QSNMPModule::snmpDeleteVar(QSNMPVar * var)
+/* Returns the column's field identifier under the parent group. */
+quint32 QSNMPColumn::fieldId() const
 {
-    QSNMPVarList::iterator it = mSnmpVarList.begin();
-    while(it != mSnmpVarList.end())
-    {
-        if(*it == var)
-        {
-            mSnmpVarList.erase(it);
-            mSnmpAgent->unregisterVar(var);
-            delete var;
-            return true;
-        }
-        else
-            it++;
-    }
-    return false;
+    return mFieldId;
 }
 
-/* Unregisters all variables (that were allocated in this module) from the agent, and frees them. */
-void QSNMPModule::snmpDeleteAllVars()
+/* Adds a reference to this column. */
+void QSNMPColumn::ref()
 {
-    while(!mSnmpVarList.isEmpty())
-    {
-        QSNMPVar * var = mSnmpVarList.takeFirst();
-        mSnmpAgent->unregisterVar(var);
-        delete var;
-    }
+    mRefCount.ref();
 }
 
+/* Removes a reference to this column, returns false if it was the last one. */
+bool QSNMPColumn::deref()
+{
+    return mRefCount.deref();
+}
 
+/* Rarely used members of an SNMP variable: the bound value (see QSNMPModule::snmpCreateBoundVar) and the
+ * value cache (see QSNMPModule::snmpSetCacheTtl), allocated along with the first of them that is set. */
+struct QSNMPVar::Extension
+{
+    /* Bound value */
+    void *                      boundValue;
+    QSNMPValidator              validator;
+    QSNMPBinding_e              binding;
 
-/*******************************************************/
-/******************** SNMP VARIABLE ********************/
-/*******************************************************/
+    /* Value cache, the expiry time is 0 when invalid, the generation is incremented by each invalidation */
+    QByteArray                  cacheValue;
+    std::atomic<qint64>         cacheExpiry;
+    std::atomic<quint32>        cacheGeneration;
+    int                         cacheTtl;
+    quint8                      cacheType;
+};
 
 /* Constructor for an SNMP variable. A variable can be either a scalar or tabular item,
  * based on 'indexes', and corresponds to an OBJECT-TYPE in the MIB syntax.
@@ -817,27 +3922,43 @@ void QSNMPModule::snmpDeleteAllVars()
  * The complete variable OID is thus 'groupOid.fieldId.indexes'. */
 QSNMPVar::QSNMPVar(QSNMPModule * module, const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
                            const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes)
+    : QSNMPVar(module, new QSNMPColumn(name, type, maxAccess, groupOid, fieldId), indexes)
+{
+}
+
+/* Constructor for an SNMP variable of a column, whose attributes (name, type, max-access, group OID
+ * and field identifier) are shared with the other variables of that column: only the variable's indexes
+ * are stored in the variable itself. The variable takes over a reference to the column. */
+QSNMPVar::QSNMPVar(QSNMPModule * module, QSNMPColumn * column, const QSNMPOid & indexes)
 {
     /* Constants */
     mModule = module;
-    mName = name;
-    mType = type;
-    mMaxAccess = maxAccess;
-    mGroupOid = groupOid;
-    mFieldId = fieldId;
-    mIndexes = indexes;
-    mOid << mGroupOid << mFieldId << mIndexes;
-    mOidString = toString(mOid);
-    mFullName = QString("%1%2").arg(mName).arg(toString(mIndexes));
+    mColumn = column;
+    mIndexCount = indexes.size();
+    quint32 * indexData = mIndexInline;
+    if(mIndexCount > qsnmpVarInlineIndexes)
+        indexData = mIndexHeap = new quint32[mIndexCount];
+    std::copy(indexes.constBegin(), indexes.constEnd(), indexData);
 
-    /* Registration (opaque) */
-    mRegistration = nullptr;
+    /* Bound value and value cache, none until set */
+    mExtension = nullptr;
 }
 
-/* Destructor for an SNMP variable. */
+/* Destructor for an SNMP variable, the column is freed along with its last variable
+ * (unless still referenced by the agent). */
 QSNMPVar::~QSNMPVar()
 {
-    /* Nothing to do */
+    delete mExtension.load(std::memory_order_relaxed);
+    if(mIndexCount > qsnmpVarInlineIndexes)
+        delete[] mIndexHeap;
+    if(!mColumn->deref())
+        delete mColumn;
+}
+
+/* Returns the column this variable belongs to. */
+QSNMPColumn * QSNMPVar::column() const
+{
+    return mColumn;
 }
 
 /* Returns the parent SNMP module. */
@@ -849,80 +3970,567 @@ QSNMPModule * QSNMPVar::module() const
 /* Returns the name of this variable. */
 const QString & QSNMPVar::name() const
 {
-    return mName;
+    return mColumn->name();
 }
 
 /* Returns the data type of this variable. */
 QSNMPType_e QSNMPVar::type() const
 {
-   return mType;
+   return mColumn->type();
 }
 
 /* Returns the maximum access level of this variable. */
 QSNMPMaxAccess_e QSNMPVar::maxAccess() const
 {
-    return mMaxAccess;
+    return mColumn->maxAccess();
 }
 
 /* Returns the group OID of this variable, that is the OID of the
  * parent group. */
 const QSNMPOid & QSNMPVar::groupOid() const
 {
-    return mGroupOid;
+    return mColumn->groupOid();
 }
 
 /* Returns the variable's field identifier under the parent group. */
 quint32 QSNMPVar::fieldId() const
 {
-    return mFieldId;
+    return mColumn->fieldId();
 }
 
 /* Returns the indexes of this variable.
  * This will be qsnmpScalarIndex (.0).0 for a scalar variable
  * or a list of values for a tabular variable. */
-const QSNMPOid & QSNMPVar::indexes() const
+QSNMPOid QSNMPVar::indexes() const
 {
-    return mIndexes;
+    return QSNMPOid(this->indexData(), mIndexCount);
 }
 
 /* Returns this variable's complete OID (groupOid.fieldId.indexes). */
-const QSNMPOid & QSNMPVar::oid() const
+QSNMPOid QSNMPVar::oid() const
 {
-    return mOid;
+    const QSNMPOid & columnOid = mColumn->oid();
+    QSNMPOid oid;
+    oid.reserve(columnOid.size() + mIndexCount);
+    oid << columnOid;
+    const quint32 * indexes = this->indexData();
+    for(int k=0; k<mIndexCount; k++)
+        oid << indexes[k];
+    return oid;
 }
 
 /* Returns this variable's complete OID (groupOid.fieldId.indexes) in string format. */
-const QString & QSNMPVar::oidString() const
+QString QSNMPVar::oidString() const
+{
+    return toString(this->oid());
+}
+
+/* Compares this variable's OID with another variable's OID. */
+int QSNMPVar::compare(const QSNMPVar * other) const
 {
-    return mOidString;
+    if(other->mColumn->oid() == mColumn->oid())
+        return qsnmpOidCompare(this->indexData(), mIndexCount, other->indexData(), other->mIndexCount);
+    QSNMPOid otherOid = other->oid();
+    return this->compare(otherOid.constData(), otherOid.size());
 }
 
 /* Returns the full name (name.indexes) for this variable. */
-const QString & QSNMPVar::fullName() const
+QString QSNMPVar::fullName() const
+{
+    return QString("%1%2").arg(mColumn->name()).arg(toString(this->indexes()));
+}
+
+/* Returns this variable's extension, allocated on first use. The value cache may be set by the agent thread
+ * while the module's thread sets the binding or the cache time-to-live, in which case a single one is kept. */
+QSNMPVar::Extension * QSNMPVar::extension()
+{
+    Extension * extension = mExtension.load(std::memory_order_acquire);
+    if(extension)
+        return extension;
+    Extension * newExtension = new Extension;
+    newExtension->boundValue = nullptr;
+    newExtension->binding = QSNMPBinding_None;
+    newExtension->cacheExpiry = 0;
+    newExtension->cacheGeneration = 0;
+    newExtension->cacheTtl = -1;
+    newExtension->cacheType = 0;
+    if(mExtension.compare_exchange_strong(extension, newExtension, std::memory_order_acq_rel))
+        return newExtension;
+    delete newExtension;
+    return extension;
+}
+
+/* Returns the type of the application value this variable is bound to,
+ * or QSNMPBinding_None if this variable is served by its parent module. */
+QSNMPBinding_e QSNMPVar::binding() const
 {
-    return mFullName;
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    return extension ? extension->binding : QSNMPBinding_None;
 }
 
-/* Gets the opaque, internal, Net-SNMP registration structure. */
-void * QSNMPVar::registration() const
+/* Returns a pointer to the application value this variable is bound to, or nullptr. */
+void * QSNMPVar::boundValue() const
 {
-    return mRegistration;
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    return extension ? extension->boundValue : nullptr;
 }
 
-/* Sets the opaque, internal, Net-SNMP registration structure. */
-void QSNMPVar::setRegistration(void * registration)
+/* Binds this variable to an application value, see QSNMPModule snmpCreateBoundVar function. */
+void QSNMPVar::setBinding(QSNMPBinding_e binding, void * value, const QSNMPValidator & validator)
 {
-    mRegistration = registration;
+    Extension * extension = this->extension();
+    extension->binding = binding;
+    extension->boundValue = value;
+    extension->validator = validator;
 }
 
-/* Returns this variable's value, by calling the snmpGetValue handler of the parent module. */
+/* Returns this variable's value, either read from the bound application value,
+ * or by calling the snmpGetValue handler of the parent module. */
 QVariant QSNMPVar::get() const
 {
+    switch(this->binding())
+    {
+    case QSNMPBinding_Int32:
+    case QSNMPBinding_AtomicInt32:
+    {
+        qint32 value = 0;
+        readBoundValue(this, value);
+        return QVariant(value);
+    }
+    case QSNMPBinding_UInt32:
+    case QSNMPBinding_AtomicUInt32:
+    {
+        quint32 value = 0;
+        readBoundValue(this, value);
+        return QVariant(value);
+    }
+    case QSNMPBinding_UInt64:
+    case QSNMPBinding_AtomicUInt64:
+    {
+        quint64 value = 0;
+        readBoundValue(this, value);
+        return QVariant(value);
+    }
+    default:
+        break;
+    }
     return mModule->snmpGetValue(this);
 }
 
-/* Sets this variable's value, by calling the snmpSetValue handler of the parent module. */
+/* Returns the time-to-live of this variable's cached value, or -1 if that of the module is used. */
+int QSNMPVar::cacheTtl() const
+{
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    return extension ? extension->cacheTtl : -1;
+}
+
+/* Sets the time-to-live (in milliseconds) of this variable's cached value, overriding that of the
+ * module (see QSNMPModule::snmpSetCacheTtl). A time-to-live of 0 disables the cache, and -1 (default)
+ * uses the module's one. */
+void QSNMPVar::setCacheTtl(int ttlMs)
+{
+    if((ttlMs < 0) && !mExtension.load(std::memory_order_acquire))
+        return;
+    this->extension()->cacheTtl = ttlMs;
+    this->invalidate();
+}
+
+/* Gets this variable's cached value, as a SNMP data type and encoded data.
+ * Returns false if there is no cached value, or if it has expired. */
+bool QSNMPVar::cachedValue(quint8 & asnType, QByteArray & value) const
+{
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    if(!extension)
+        return false;
+    qint64 expiry = extension->cacheExpiry.load(std::memory_order_acquire);
+    if(!expiry || (clockMs() >= expiry))
+        return false;
+    asnType = extension->cacheType;
+    value = extension->cacheValue;
+    return true;
+}
+
+/* Returns this variable's cache generation, to be taken before reading the value to be cached (see setCachedValue). */
+quint32 QSNMPVar::cacheGeneration() const
+{
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    return extension ? extension->cacheGeneration.load() : 0;
+}
+
+/* Keeps a value in this variable's cache, as a SNMP data type and encoded data, if caching is enabled.
+ * The value is dropped if the variable was invalidated since 'generation' was taken (see cacheGeneration),
+ * including while it is being stored. */
+void QSNMPVar::setCachedValue(quint8 asnType, const void * data, size_t len, quint32 generation)
+{
+    Extension * extension = mExtension.load(std::memory_order_acquire);
+    int ttl = (extension && (extension->cacheTtl >= 0)) ? extension->cacheTtl : mModule->snmpCacheTtl();
+    if(ttl <= 0)
+        return;
+    extension = this->extension();
+    if(extension->cacheGeneration.load() != generation)
+        return;
+    extension->cacheType = asnType;
+    extension->cacheValue = QByteArray((const char *)data, (int)len);
+    extension->cacheExpiry.store(clockMs() + ttl);
+    if(extension->cacheGeneration.load() != generation)
+        extension->cacheExpiry.store(0);
+}
+
+/* Invalidates this variable's cached value, so that it is read again from the user application.
+ * A value being read meanwhile is not cached either (see setCachedValue). */
+void QSNMPVar::invalidate()
+{
+    Extension * extension = mExtension.load(std::memory_order_acquire);
+    if(!extension)
+    {
+        /* Nothing cached yet, but a value may be being read */
+        if(mModule->snmpCacheTtl() <= 0)
+            return;
+        extension = this->extension();
+    }
+    extension->cacheGeneration.fetch_add(1);
+    extension->cacheExpiry.store(0);
+}
+
+/* Checks a value before it is set, either with the bound value's validator (if any),
+ * or by calling the snmpSetCheck handler of the parent module. */
+bool QSNMPVar::check(const QVariant & v) const
+{
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    if(!extension || (extension->binding == QSNMPBinding_None))
+        return mModule->snmpSetCheck(this, v);
+    return !extension->validator || extension->validator(this, v);
+}
+
+/* Sets this variable's value, either written to the bound application value (if accepted by
+ * the validator, if any), or by calling the snmpSetValue handler of the parent module. */
 bool QSNMPVar::set(const QVariant & v) const
 {
-    return mModule->snmpSetValue(this, v);
+    const Extension * extension = mExtension.load(std::memory_order_acquire);
+    if(!extension || (extension->binding == QSNMPBinding_None))
+        return mModule->snmpSetValue(this, v);
+    if(extension->validator && !extension->validator(this, v))
+        return false;
+    void * boundValue = extension->boundValue;
+    switch(extension->binding)
+    {
+    case QSNMPBinding_Int32:
+        *static_cast<qint32 *>(boundValue) = v.value<qint32>();
+        break;
+    case QSNMPBinding_AtomicInt32:
+        static_cast<std::atomic<qint32> *>(boundValue)->store(v.value<qint32>(), std::memory_order_relaxed);
+        break;
+    case QSNMPBinding_UInt32:
+        *static_cast<quint32 *>(boundValue) = v.value<quint32>();
+        break;
+    case QSNMPBinding_AtomicUInt32:
+        static_cast<std::atomic<quint32> *>(boundValue)->store(v.value<quint32>(), std::memory_order_relaxed);
+        break;
+    case QSNMPBinding_UInt64:
+        *static_cast<quint64 *>(boundValue) = v.value<quint64>();
+        break;
+    case QSNMPBinding_AtomicUInt64:
+        static_cast<std::atomic<quint64> *>(boundValue)->store(v.value<quint64>(), std::memory_order_relaxed);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+
+
+/****************************************************/
+/******************** SNMP TABLE ********************/
+/****************************************************/
+
+/* Constructor for an empty row index. */
+QSNMPRowIndex::QSNMPRowIndex()
+{
+}
+
+/* Returns the number of rows. */
+int QSNMPRowIndex::size() const
+{
+    QMutexLocker locker(&mLock);
+    return (int)mIndexes.size();
+}
+
+/* Returns true if there is a row of the given index. */
+bool QSNMPRowIndex::contains(const QSNMPOid & index) const
+{
+    QMutexLocker locker(&mLock);
+    return (mIndexes.find(index) != mIndexes.end());
+}
+
+/* Adds a row, returns false if there already is a row of that index. */
+bool QSNMPRowIndex::insert(const QSNMPOid & index)
+{
+    QMutexLocker locker(&mLock);
+    return mIndexes.insert(index).second;
+}
+
+/* Removes a row, returns false if there is no row of that index. */
+bool QSNMPRowIndex::remove(const QSNMPOid & index)
+{
+    QMutexLocker locker(&mLock);
+    return (mIndexes.erase(index) > 0);
+}
+
+/* Removes all rows. */
+void QSNMPRowIndex::clear()
+{
+    QMutexLocker locker(&mLock);
+    mIndexes.clear();
+}
+
+/* Gets the index of the first row, returns false if there is no row. */
+bool QSNMPRowIndex::first(QSNMPOid & index) const
+{
+    QMutexLocker locker(&mLock);
+    if(mIndexes.empty())
+        return false;
+    index = *mIndexes.begin();
+    return true;
+}
+
+/* Gets the index of the row following 'index' (which is not necessarily the index of a row),
+ * returns false if there is no such row. */
+bool QSNMPRowIndex::next(const QSNMPOid & index, QSNMPOid & next) const
+{
+    QMutexLocker locker(&mLock);
+    std::set<QSNMPOid>::const_iterator it = mIndexes.upper_bound(index);
+    if(it == mIndexes.end())
+        return false;
+    next = *it;
+    return true;
+}
+
+/* Constructor for a SNMP table, registers the table with the agent. The columns are those of the table
+ * entry (entryOid.fieldId), the cells of the columns not readable being never served. */
+QSNMPTable::QSNMPTable(QSNMPAgent * snmpAgent, const QString & name, const QSNMPOid & entryOid,
+                       const QList<QSNMPTableColumn> & columns)
+{
+    /* Initialize member variables, columns ordered by fieldId for GETNEXT requests */
+    mSnmpAgent = snmpAgent;
+    mSnmpName = name;
+    mSnmpEntryOid = entryOid;
+    mSnmpColumns = columns;
+    std::sort(mSnmpColumns.begin(), mSnmpColumns.end(), [](const QSNMPTableColumn & a, const QSNMPTableColumn & b)
+    {
+        return a.fieldId < b.fieldId;
+    });
+
+    /* Called from the agent thread by default */
+    mSnmpCallContext = nullptr;
+
+    /* Register, the callbacks are only called upon requests */
+    mSnmpAgent->registerTable(this);
+}
+
+/* Returns the object through which this table is called, see snmpSetCallContext. */
+QObject * QSNMPTable::snmpCallContext() const
+{
+    return mSnmpCallContext;
+}
+
+/* Sets the object through which this table is called when the agent runs on its own thread
+ * (QSNMPThreadMode_Worker), as for modules (see QSNMPModule::snmpSetCallContext): the table's callbacks
+ * (snmpGetCell, snmpNextIndex, etc.) are then called on the thread of that object, with a blocking queued
+ * call from the agent thread. By default (nullptr), the callbacks are called directly from the agent thread,
+ * and must thus be thread-safe. The object must outlive the table. */
+void QSNMPTable::snmpSetCallContext(QObject * context)
+{
+    mSnmpCallContext = context;
+}
+
+/* Destructor for a SNMP table, unregisters the table from the agent. */
+QSNMPTable::~QSNMPTable()
+{
+    mSnmpAgent->unregisterTable(this);
+}
+
+/* Returns the SNMP agent that the table is registered to. */
+QSNMPAgent * QSNMPTable::snmpAgent() const
+{
+    return mSnmpAgent;
+}
+
+/* Returns the name of the table. */
+const QString & QSNMPTable::snmpName() const
+{
+    return mSnmpName;
+}
+
+/* Returns the OID of the table entry. */
+const QSNMPOid & QSNMPTable::snmpEntryOid() const
+{
+    return mSnmpEntryOid;
+}
+
+/* Returns the columns of the table, ordered by fieldId. */
+const QList<QSNMPTableColumn> & QSNMPTable::snmpColumns() const
+{
+    return mSnmpColumns;
+}
+
+/* Returns the column of the given fieldId, or nullptr if the table has no such column. */
+const QSNMPTableColumn * QSNMPTable::snmpColumn(quint32 fieldId) const
+{
+    for(int k=0; k<mSnmpColumns.size(); k++)
+    {
+        if(mSnmpColumns[k].fieldId == fieldId)
+            return &mSnmpColumns[k];
+    }
+    return nullptr;
+}
+
+/* Returns the number of rows, default implementation over the table's row index. */
+int QSNMPTable::snmpRowCount()
+{
+    return mSnmpRows.size();
+}
+
+/* Gets the index of the first row, default implementation over the table's row index. */
+bool QSNMPTable::snmpFirstIndex(QSNMPOid & index)
+{
+    return mSnmpRows.first(index);
+}
+
+/* Gets the index of the row following 'index', default implementation over the table's row index. */
+bool QSNMPTable::snmpNextIndex(const QSNMPOid & index, QSNMPOid & next)
+{
+    return mSnmpRows.next(index, next);
+}
+
+/* Returns true if the table's row index has a row of the given index. */
+bool QSNMPTable::snmpHasRow(const QSNMPOid & index) const
+{
+    return mSnmpRows.contains(index);
+}
+
+/* Adds a row to the table's row index, returns false if there already is a row of that index.
+ * The row is served as soon as added, without any registration with the master agent. */
+bool QSNMPTable::snmpAddRow(const QSNMPOid & index)
+{
+    return mSnmpRows.insert(index);
+}
+
+/* Removes a row from the table's row index, returns false if there is no row of that index. */
+bool QSNMPTable::snmpRemoveRow(const QSNMPOid & index)
+{
+    return mSnmpRows.remove(index);
+}
+
+/* Removes all rows from the table's row index. */
+void QSNMPTable::snmpClearRows()
+{
+    mSnmpRows.clear();
+}
+
+/* Sets a cell's value, default implementation for tables without read-write columns. */
+bool QSNMPTable::snmpSetCell(const QSNMPOid & index, quint32 fieldId, const QVariant & v)
+{
+    Q_UNUSED(index)
+    Q_UNUSED(fieldId)
+    Q_UNUSED(v)
+    return false;
+}
+
+
+
+/***************************************************/
+/******************** SNMP TRAP ********************/
+/***************************************************/
+
+/* Constructor for a SNMP trap template, corresponding to a NOTIFICATION-TYPE in the MIB syntax.
+ * The 'name', 'groupOid', 'fieldId' and 'varList' arguments are the same as those of
+ * QSNMPAgent sendTrap function. The trap OID and the variables' OIDs are encoded once here,
+ * into variable bindings that are then reused by every send, so that sending the trap only
+ * reads the variables' values. Null variables are ignored, the variables must outlive the trap. */
+QSNMPTrap::QSNMPTrap(QSNMPAgent * agent, const QString & name, const QSNMPOid & groupOid, quint32 fieldId,
+                     const QSNMPVarList & varList)
+{
+    mAgent = agent;
+    mName = name;
+    mTrapOid << groupOid << fieldId;
+    foreach(QSNMPVar * var, varList)
+    {
+        if(var && (var->type() < QSNMPType_Null))
+            mVarList << var;
+    }
+
+    /* Variables bindings, snmpTrapOID.0 then the variables, allocated and linked once.
+     * None if the trap OID is too long, the trap is then never sent. */
+    mVarbinds = nullptr;
+    oid snmpOid[MAX_OID_LEN];
+    size_t snmpOidLen;
+    if(!convertOidQtToSnmp(mTrapOid, snmpOid, &snmpOidLen))
+        return;
+    netsnmp_variable_list * varbinds = new netsnmp_variable_list[mVarList.size()+1]();
+    static oid snmpTrapOid[] = { 1, 3, 6, 1, 6, 3, 1, 1, 4, 1, 0 };
+    snmp_set_var_objid(&varbinds[0], snmpTrapOid, sizeof(snmpTrapOid)/sizeof(oid));
+    snmp_set_var_typed_value(&varbinds[0], ASN_OBJECT_ID, snmpOid, snmpOidLen*sizeof(oid));
+    for(int k=0; k<mVarList.size(); k++)
+    {
+        /* Variable OID, its length was checked when registered */
+        convertOidQtToSnmp(mVarList[k]->oid(), snmpOid, &snmpOidLen);
+        snmp_set_var_objid(&varbinds[k+1], snmpOid, snmpOidLen);
+        snmp_set_var_typed_value(&varbinds[k+1], ASN_NULL, nullptr, 0);
+        varbinds[k].next_variable = &varbinds[k+1];
+    }
+    mVarbinds = varbinds;
+}
+
+/* Destructor for a SNMP trap template. */
+QSNMPTrap::~QSNMPTrap()
+{
+    netsnmp_variable_list * varbinds = (netsnmp_variable_list *)mVarbinds;
+    if(!varbinds)
+        return;
+    for(int k=0; k<=mVarList.size(); k++)
+        snmp_free_var_internals(&varbinds[k]);
+    delete [] varbinds;
+}
+
+/* Returns the SNMP agent this trap is sent to. */
+QSNMPAgent * QSNMPTrap::agent() const
+{
+    return mAgent;
+}
+
+/* Returns the name of this trap. */
+const QString & QSNMPTrap::name() const
+{
+    return mName;
+}
+
+/* Returns the OID of this trap, that is 'groupOid.fieldId'. */
+const QSNMPOid & QSNMPTrap::trapOid() const
+{
+    return mTrapOid;
+}
+
+/* Returns the variables bound to this trap. */
+const QSNMPVarList & QSNMPTrap::varList() const
+{
+    return mVarList;
+}
+
+/* Returns the pre-encoded variable bindings of this trap (opaque Net-SNMP variable list). */
+void * QSNMPTrap::varbinds() const
+{
+    return mVarbinds;
+}
+
+/* Returns the lock of the pre-encoded variable bindings, held while they are refreshed and sent. */
+QMutex * QSNMPTrap::varbindsLock() const
+{
+    return &mVarbindsLock;
+}
+
+/* Sends this trap to the Net-SNMP master agent, with the current values of its variables. */
+void QSNMPTrap::send() const
+{
+    mAgent->sendTrap(*this);
 }
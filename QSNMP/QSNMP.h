@@ -30,10 +30,18 @@ SOFTWARE. */
 #include <QMetaType>
 #include <QVector>
 #include <QMap>
+#include <QHash>
 #include <QList>
 #include <QObject>
 #include <QVariant>
 #include <QElapsedTimer>
+#include <QFuture>
+#include <QMutex>
+#include <QAtomicInt>
+#include <set>
+#include <atomic>
+#include <functional>
+#include <cstddef>
 
 
 
@@ -85,10 +93,142 @@ typedef enum
 } QSNMPLogType_e;
 Q_DECLARE_METATYPE(QSNMPLogType_e)
 
-/* SNMP OID stored as QVector */
-typedef QVector<quint32> QSNMPOid;
+/* SNMP variable bound value types (see QSNMPModule::snmpCreateBoundVar) */
+typedef enum
+{
+    QSNMPBinding_None = 0,
+    QSNMPBinding_Int32,         /* qint32 */
+    QSNMPBinding_UInt32,        /* quint32 */
+    QSNMPBinding_UInt64,        /* quint64 */
+    QSNMPBinding_AtomicInt32,   /* std::atomic<qint32> */
+    QSNMPBinding_AtomicUInt32,  /* std::atomic<quint32> */
+    QSNMPBinding_AtomicUInt64,  /* std::atomic<quint64> */
+} QSNMPBinding_e;
+Q_DECLARE_METATYPE(QSNMPBinding_e)
+
+/* SNMP variables registration mode with the Net-SNMP library */
+typedef enum
+{
+    QSNMPRegistration_Instance = 0, // One instance registration per variable
+    QSNMPRegistration_Group,        // One subtree registration per group OID, shared by all variables of that group
+} QSNMPRegistration_e;
+Q_DECLARE_METATYPE(QSNMPRegistration_e)
+
+/* SNMP agent event processing mode */
+typedef enum
+{
+    QSNMPEventMode_Polling = 0,     // The Net-SNMP library is polled by an adaptive timer
+    QSNMPEventMode_SocketNotifier,  // The Net-SNMP sockets and timeouts are watched by the Qt event loop
+} QSNMPEventMode_e;
+Q_DECLARE_METATYPE(QSNMPEventMode_e)
+
+/* SNMP agent threading mode */
+typedef enum
+{
+    QSNMPThreadMode_Caller = 0,     // The agent runs on the thread that created it (i.e. the main thread)
+    QSNMPThreadMode_Worker,         // The agent runs on its own worker thread
+} QSNMPThreadMode_e;
+Q_DECLARE_METATYPE(QSNMPThreadMode_e)
+
+inline quint32 qsnmpLogMask(QSNMPLogType_e logType) { return 1u << logType; } // Bit of a log type in the agent log mask
+static const quint32 qsnmpLogMaskAll = 0xFFFFFFFF; // All log types enabled in the agent log mask
+
+/* Recursive mutex, QMutex::Recursive being deprecated as of Qt 5.15 in favour of QRecursiveMutex */
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+typedef QRecursiveMutex QSNMPRecursiveMutex;
+#else
+class QSNMPRecursiveMutex : public QMutex { public: QSNMPRecursiveMutex() : QMutex(QMutex::Recursive) {} };
+#endif
+
+/* SNMP OID, with up to qsnmpOidInlineArcs arcs stored inline (without any heap allocation) and longer
+ * OIDs stored on the heap. Its interface follows that of QVector<quint32>, to/from which it converts. */
+static const int qsnmpOidInlineArcs = 20;
+class QSNMPOid
+{
+
+public:
+    typedef quint32             value_type;
+    typedef quint32 *           iterator;
+    typedef const quint32 *     const_iterator;
+
+                                QSNMPOid() : mSize(0), mCapacity(qsnmpOidInlineArcs) {}
+                                QSNMPOid(std::initializer_list<quint32> arcs);
+                                QSNMPOid(const quint32 * arcs, int len);
+                                QSNMPOid(const QVector<quint32> & vector);
+                                QSNMPOid(const QSNMPOid & other);
+                                QSNMPOid(QSNMPOid && other);
+                                ~QSNMPOid();
+    QSNMPOid &                  operator=(const QSNMPOid & other);
+    QSNMPOid &                  operator=(QSNMPOid && other);
+
+    /* Getters */
+    int                         size() const { return mSize; }
+    int                         count() const { return mSize; }
+    int                         length() const { return mSize; }
+    bool                        isEmpty() const { return mSize == 0; }
+    int                         capacity() const { return mCapacity; }
+    const quint32 *             constData() const { return (mCapacity > qsnmpOidInlineArcs) ? mHeap : mInline; }
+    const quint32 *             data() const { return this->constData(); }
+    quint32 *                   data() { return (mCapacity > qsnmpOidInlineArcs) ? mHeap : mInline; }
+    const quint32 &             at(int k) const { return this->constData()[k]; }
+    const quint32 &             operator[](int k) const { return this->constData()[k]; }
+    quint32 &                   operator[](int k) { return this->data()[k]; }
+    const quint32 &             first() const { return this->constData()[0]; }
+    const quint32 &             last() const { return this->constData()[mSize-1]; }
+    QSNMPOid                    mid(int pos, int len = -1) const;
+    bool                        startsWith(const QSNMPOid & prefix) const;
+    QVector<quint32>            toVector() const;
+
+    /* Iteration */
+    iterator                    begin() { return this->data(); }
+    iterator                    end() { return this->data() + mSize; }
+    const_iterator              begin() const { return this->constData(); }
+    const_iterator              end() const { return this->constData() + mSize; }
+    const_iterator              constBegin() const { return this->constData(); }
+    const_iterator              constEnd() const { return this->constData() + mSize; }
+
+    /* Modifiers */
+    void                        clear() { mSize = 0; }
+    void                        reserve(int capacity);
+    void                        resize(int size);
+    void                        removeLast() { mSize--; }
+    void                        append(quint32 arc) { if(mSize == mCapacity) this->reserve(2*mCapacity); this->data()[mSize++] = arc; }
+    void                        append(const QSNMPOid & other);
+    QSNMPOid &                  operator<<(quint32 arc) { this->append(arc); return *this; }
+    QSNMPOid &                  operator<<(const QSNMPOid & other) { this->append(other); return *this; }
+    QSNMPOid &                  operator+=(quint32 arc) { this->append(arc); return *this; }
+    QSNMPOid &                  operator+=(const QSNMPOid & other) { this->append(other); return *this; }
+
+    /* Comparison, in lexicographic order */
+    bool                        operator==(const QSNMPOid & other) const;
+    bool                        operator!=(const QSNMPOid & other) const { return !(*this == other); }
+    bool                        operator<(const QSNMPOid & other) const;
+
+private:
+    int                         mSize;
+    int                         mCapacity;
+    union
+    {
+        quint32                 mInline[qsnmpOidInlineArcs];
+        quint32 *               mHeap;
+    };
+
+};
+uint qHash(const QSNMPOid & oid, uint seed = 0);
+Q_DECLARE_METATYPE(QSNMPOid)
 QString toString(const QSNMPOid & oid);
+template<typename A, typename B> int qsnmpOidCompare(const A * a, size_t aLen, const B * b, size_t bLen);
 static const QSNMPOid qsnmpScalarIndex = QSNMPOid() << 0; // Scalar variable OID index (.0), as opposed to tabular variable
+static const int qsnmpVarInlineIndexes = 4; // Indexes stored within a SNMP variable (i.e. an IPv4 address), longer ones are allocated
+
+/* Token of a GET request answered later by the user application (see QSNMPAgent::completeRequest) */
+typedef quint64 QSNMPRequestToken;
+
+/* Qt forward declarations */
+class QTimer;
+class QSocketNotifier;
+class QThread;
+class QMutexLocker;
 
 /* SNMP agent forward declaration */
 class QSNMPAgent;
@@ -96,10 +236,129 @@ class QSNMPAgent;
 /* SNMP module forward declaration */
 class QSNMPModule;
 
-/* SNMP variable forward declaration */
+/* SNMP trap forward declaration */
+class QSNMPTrap;
+
+/* SNMP table forward declaration */
+class QSNMPTable;
+
+/* SNMP variable forward declarations */
 class QSNMPVar;
-typedef QMap<QString, QSNMPVar *> QSNMPVarMap; // Map of SNMP variables, where key is OID=toString(QSNMPOid)
+class QSNMPColumn;
 typedef QList<QSNMPVar *> QSNMPVarList; // List of SNMP variables
+typedef std::function<bool(const QSNMPVar * var, const QVariant & v)> QSNMPValidator; // Bound variable SET validator
+
+/* Raw OID arcs (i.e. a Net-SNMP 'oid' buffer), used to search a QSNMPVarMap without building a QSNMPOid */
+template<typename T> struct QSNMPOidKey
+{
+    const T *                   arcs;
+    size_t                      len;
+};
+
+/* Lexicographic OID ordering of SNMP variables, also comparable against raw OID arcs */
+struct QSNMPVarOidLess
+{
+    typedef void                is_transparent;
+    bool                        operator()(const QSNMPVar * a, const QSNMPVar * b) const;
+    template<typename T> bool   operator()(const QSNMPVar * a, const QSNMPOidKey<T> & b) const;
+    template<typename T> bool   operator()(const QSNMPOidKey<T> & a, const QSNMPVar * b) const;
+};
+
+
+
+/***********************************************************/
+/******************** SNMP VARIABLE MAP ********************/
+/***********************************************************/
+
+/* QSNMPVarMap class definition: SNMP variables ordered by OID.
+ * Lookups can be done straight from a raw OID buffer, without any allocation. */
+class QSNMPVarMap
+{
+    typedef std::set<QSNMPVar *, QSNMPVarOidLess> Index;
+
+public:
+    /* Iterator over the variables, in OID order */
+    class const_iterator
+    {
+    public:
+                                const_iterator() {}
+                                const_iterator(Index::const_iterator it) : mIt(it) {}
+        QSNMPOid                key() const;
+        QSNMPVar *              value() const { return *mIt; }
+        QSNMPVar *              operator*() const { return *mIt; }
+        const_iterator &        operator++() { ++mIt; return *this; }
+        const_iterator          operator++(int) { const_iterator it = *this; ++mIt; return it; }
+        const_iterator &        operator--() { --mIt; return *this; }
+        const_iterator          operator--(int) { const_iterator it = *this; --mIt; return it; }
+        bool                    operator==(const const_iterator & other) const { return mIt == other.mIt; }
+        bool                    operator!=(const const_iterator & other) const { return mIt != other.mIt; }
+    private:
+        Index::const_iterator   mIt;
+    };
+
+    /* Getters */
+    int                         size() const;
+    bool                        isEmpty() const;
+    bool                        contains(const QSNMPOid & oid) const;
+    QSNMPVar *                  value(const QSNMPOid & oid) const;
+    QSNMPVarList                values() const;
+
+    /* Iteration */
+    const_iterator              begin() const;
+    const_iterator              end() const;
+    const_iterator              constBegin() const;
+    const_iterator              constEnd() const;
+
+    /* Raw OID lookups: exact match, first variable >= OID, first variable > OID */
+    template<typename T> QSNMPVar *     find(const T * arcs, size_t len) const;
+    template<typename T> const_iterator lowerBound(const T * arcs, size_t len) const;
+    template<typename T> const_iterator upperBound(const T * arcs, size_t len) const;
+
+    /* Insertion/removal (called by QSNMPAgent and QSNMPModule) */
+    bool                        insert(QSNMPVar * var);
+    bool                        remove(QSNMPVar * var);
+    void                        clear();
+
+private:
+    Index                       mIndex;
+
+};
+
+
+
+/***********************************************************/
+/******************** SNMP MEMORY POOL *********************/
+/***********************************************************/
+
+/* QSNMPPool class definition: storage for objects of a fixed size (i.e. the SNMP variables of an agent),
+ * allocated by chunks and recycled through a free list, so that creating and deleting table rows does
+ * not hit the heap allocator. Thread-safe: shared by modules which may live in different threads. */
+class QSNMPPool
+{
+
+public:
+                                QSNMPPool(size_t objectSize);
+                                ~QSNMPPool();
+
+    /* Getters */
+    size_t                      objectSize() const;
+    int                         size() const;
+    int                         capacity() const;
+
+    /* Allocation */
+    void *                      allocate();
+    void                        release(void * object);
+
+private:
+    size_t                      mSlotSize;
+    int                         mSize;
+    int                         mCapacity;
+    QVector<char *>             mChunks;
+    void *                      mFreeList;
+    mutable QMutex              mLock;
+
+    Q_DISABLE_COPY(QSNMPPool)
+};
 
 
 
@@ -115,14 +374,39 @@ public:
                                 QSNMPAgent(const QString & agentName, const QString & agentAddr = QString());
     virtual                     ~QSNMPAgent();
 
-    /* Variables managed under this agent */
+    /* Variables managed under this agent, ordered by OID */
     const QSNMPVarMap &         varMap() const;
+    QSNMPRegistration_e         registrationMode() const;
+    void                        setRegistrationMode(QSNMPRegistration_e mode);
     bool                        registerVar(QSNMPVar * var);
     void                        unregisterVar(QSNMPVar * var);
+    void                        unregisterVars(const QSNMPVarList & varList);
+    void                        beginBatch();
+    void                        commitBatch();
+
+    /* Tables served from the user application (see QSNMPTable) */
+    bool                        registerTable(QSNMPTable * table);
+    void                        unregisterTable(QSNMPTable * table);
+
+    /* SNMP agent event processing */
+    QSNMPEventMode_e            eventMode() const;
+    void                        setEventMode(QSNMPEventMode_e mode);
+    QSNMPThreadMode_e           threadMode() const;
+    void                        setThreadMode(QSNMPThreadMode_e mode);
 
     /* SNMP agent event processing (Net-SNMP internal) */
     int                         handler(void * handler, void * reginfo, void * reqinfo, void * requests);
 
+    /* Delegated GET requests (see QSNMPModule::snmpGetValueAsync) */
+    bool                        completeRequest(QSNMPRequestToken token, const QVariant & v);
+    void                        completeRequest(QSNMPRequestToken token, const QFuture<QVariant> & future);
+
+    /* Logging */
+    bool                        logEnabled(QSNMPLogType_e logType) const;
+    void                        setLogEnabled(QSNMPLogType_e logType, bool enabled);
+    quint32                     logMask() const;
+    void                        setLogMask(quint32 mask);
+
     /* Traps */
     bool                        trapsEnabled() const;
     void                        setTrapsEnabled(bool enabled);
@@ -130,23 +414,212 @@ public:
                                          quint32 fieldId, QSNMPVar * var = nullptr);
     void                        sendTrap(const QString & name, const QSNMPOid & groupOid,
                                          quint32 fieldId, const QSNMPVarList & varList);
+    void                        sendTrap(const QSNMPTrap & trap);
+    int                         trapCoalescing() const;
+    void                        setTrapCoalescing(int windowMs);
+    int                         trapRateLimit() const;
+    void                        setTrapRateLimit(int trapsPerSecond, int burst);
+    quint64                     trapsSent() const;
+    quint64                     trapsSuppressed() const;
+    quint64                     trapsDropped() const;
+
+    /* Self-monitoring statistics, optionally exported under a MIB subtree */
+    bool                        statisticsEnabled() const;
+    void                        setStatisticsEnabled(bool enabled, const QSNMPOid & groupOid = QSNMPOid());
+    quint64                     getRequests() const;
+    quint64                     getNextRequests() const;
+    quint64                     setRequests() const;
+    quint64                     requestErrors() const;
+    quint64                     registerFailures() const;
+    quint32                     handlerLatency(int percentile) const;
+    QList<QSNMPModule *>        modules() const;
+
+    /* Modules bookkeeping (called by QSNMPModule) */
+    void                        addModule(QSNMPModule * module);
+    void                        removeModule(QSNMPModule * module);
+    QSNMPPool *                 varPool();
+    QSNMPColumn *               acquireColumn(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId);
+    void                        releaseColumns();
 
 private:
     /* Name */
     QString                     mAgentName;
 
-    /* Variables */
+    /* Variables, the map is locked while being used by the agent thread or modified by another thread */
     QSNMPVarMap                 mVarMap;
+    mutable QSNMPRecursiveMutex mVarMapLock;
+    QSNMPRegistration_e         mRegistrationMode;
+
+    /* Net-SNMP registrations (opaque) per variable, only used from the agent thread: the variable is only
+     * used as a key, since it may have been deleted by the time its (un)registration runs */
+    QHash<const QSNMPVar *, void *> mRegistrations;
+    void *                      registerOid(const QSNMPVar * var, const QString & name, const QSNMPOid & oid, const QSNMPOid & groupOid,
+                                            QSNMPMaxAccess_e maxAccess, QSNMPRegistration_e mode, QString * error);
+    void                        unregisterOid(const QSNMPVar * var, const QSNMPOid & oid, const QSNMPOid & groupOid);
+    void                        unregisterOids(const QSNMPVarList & vars, const QVector<QSNMPOid> & oids, const QVector<QSNMPOid> & groupOids);
+    void                        releaseRegistration(void * registration, const QSNMPOid & oid, const QSNMPOid & groupOid, int count);
+
+    /* Group registrations (opaque), shared by all variables of a group */
+    typedef struct
+    {
+        void *                  registration;
+        int                     refCount;
+    } GroupRegistration;
+    QMap<QSNMPOid, GroupRegistration> mGroupRegistrations;
+
+    /* Range registrations (opaque), shared by the variables of a range, per parent OID */
+    typedef struct
+    {
+        void *                  registration;
+        quint32                 first;
+        quint32                 last;
+        bool                    readWrite;
+        int                     refCount;
+    } RangeRegistration;
+    QHash<QSNMPOid, QList<RangeRegistration> > mRangeRegistrations;
+
+    /* Batch of deferred registrations (see beginBatch), in no particular order and indexed per variable,
+     * locked along with the variable map */
+    typedef struct
+    {
+        QSNMPVar *              var;
+        QString                 name;
+        QString                 fullName;
+        QSNMPOid                oid;
+        QSNMPOid                groupOid;
+        QSNMPMaxAccess_e        maxAccess;
+        QSNMPRegistration_e     mode;
+    } BatchRegistration;
+    int                         mBatchDepth;
+    QVector<BatchRegistration>  mBatch;
+    QHash<QSNMPVar *, int>      mBatchIndexes;
+    bool                        inBatch();
+    bool                        removeFromBatch(QSNMPVar * var);
+    void                        registerBatch(QVector<BatchRegistration> batch);
+
+    /* Tables per Net-SNMP registration (opaque), and tables waiting for their registration by the agent
+     * thread, locked along with the variable map */
+    QHash<void *, QSNMPTable *> mTables;
+    QList<QSNMPTable *>         mPendingTables;
+    int                         processTableRequests(QSNMPTable * table, void * reginfo, void * reqinfo, void * requests);
+    void                        logCellValue(QSNMPLogType_e logType, const char * prefix, const QSNMPTable * table,
+                                             quint32 fieldId, const QSNMPOid & index, const QVariant & v);
+
+    /* SET requests in progress (per Net-SNMP request) */
+    typedef struct
+    {
+        QVariant                value;
+        QVariant                oldValue;
+        bool                    applied;
+    } PendingSet;
+    QHash<void *, PendingSet>   mPendingSets;
+
+    /* GET requests in progress (see handler) */
+    struct PendingGet;
+    bool                        readValues(void * handler, void * reginfo, void * reqinfo, QVector<PendingGet> & pendingGets,
+                                           int first, int last, bool log, bool queued);
+
+    /* Delegated GET requests in progress (opaque Net-SNMP delegated cache), only used from the agent thread
+     * or while the agent thread waits for a module */
+    QHash<QSNMPRequestToken, void *> mDelegatedGets;
+    QSNMPRequestToken           mNextRequestToken;
+
+    /* Nesting of handler calls on the agent thread, the Net-SNMP library is not processed within them */
+    int                         mHandlerDepth;
+
+    /* Module callbacks from the agent thread (see QSNMPModule::snmpSetCallContext) */
+    bool                        callModule(QObject * context, QMutexLocker & locker, const std::function<void()> & function);
 
     /* SNMP agent event processing */
+    QSNMPEventMode_e            mEventMode;
     QElapsedTimer               mTimer;
+    QTimer *                    mPollTimer;
+    QTimer *                    mTimeoutTimer;
+    QMap<int, QSocketNotifier *> mSocketNotifiers;
+    void                        updateSocketNotifiers();
+    void                        processLibrary();
+
+    /* SNMP agent worker thread */
+    QSNMPThreadMode_e           mThreadMode;
+    QThread *                   mThread;
+    QThread *                   mOwnerThread;
+    QAtomicInt                  mStopping;
+    void                        stopThread();
+
+    /* Logging, the log mask being read by any thread handling requests */
+    QAtomicInteger<quint32>     mLogMask;
+    void                        logVarValue(QSNMPLogType_e logType, const char * prefix, const QSNMPVar * var, const QVariant & v);
 
     /* Traps */
     bool                        mTrapsEnabled;
+    void                        dispatchTrap(const QString & name, const QSNMPOid & trapOid, const QSNMPVarList & varList,
+                                             void * varbinds, const QVector<QVariant> & values, bool log);
+    void                        logTrap(const QString & name, const QSNMPVarList & varList, const QVector<QVariant> & values);
+    void                        sendTrapVarbinds(void * varbinds);
+
+    /* Traps queue (coalescing and rate limiting), locked since traps may be sent from any thread */
+    typedef struct
+    {
+        QSNMPOid                key;
+        qint64                  dueMs;
+        void *                  varbinds;
+    } QueuedTrap;
+    typedef struct
+    {
+        double                  tokens;
+        qint64                  timeMs;
+    } TrapBucket;
+    mutable QMutex              mTrapLock;
+    int                         mTrapCoalescingMs;
+    int                         mTrapRate;
+    int                         mTrapBurst;
+    QMap<quint64, QueuedTrap>   mTrapQueue;
+    QHash<QSNMPOid, quint64>    mTrapQueueKeys;
+    quint64                     mTrapSeq;
+    QHash<QSNMPOid, TrapBucket> mTrapBuckets;
+    quint64                     mTrapsSent;
+    quint64                     mTrapsSuppressed;
+    quint64                     mTrapsDropped;
+    QTimer *                    mTrapTimer;
+
+    /* Self-monitoring statistics, updated lock-free while enabled, and modules (locked along with the
+     * variable map). The handler latency histogram has a bucket per power of 2 microseconds. */
+    static const int            latencyBuckets = 32;
+    std::atomic<bool>           mStatsEnabled;
+    std::atomic<quint64>        mStatsGetRequests;
+    std::atomic<quint64>        mStatsGetNextRequests;
+    std::atomic<quint64>        mStatsSetRequests;
+    std::atomic<quint64>        mStatsRequestErrors;
+    std::atomic<quint64>        mStatsRegisterFailures;
+    std::atomic<quint64>        mStatsLatency[latencyBuckets];
+    long                        mStatsLastPdu;          // Last PDU counted (agent thread only), see recordRequest
+    long                        mStatsLastErrorPdu;     // Last PDU counted as failed (agent thread only)
+    QSNMPModule *               mStatsModule;
+    QList<QSNMPModule *>        mModules;
+    QHash<QSNMPModule *, quint64> mModuleGenerations;  // Per linked module, tells a deleted module from a new one at the same address
+    quint64                     mNextModuleGeneration;
+
+    /* Storage of the variables of all modules, shared so that one module per table row recycles the rows' memory */
+    QSNMPPool                   mVarPool;
+
+    /* Column descriptors shared by the variables of all modules, per column OID (groupOid.fieldId) */
+    QHash<QSNMPOid, QList<QSNMPColumn *> > mColumns;
+    QMutex                      mColumnsLock;
+
+    /* Request processing, locked and timed by handler */
+    int                         processRequests(void * handler, void * reginfo, void * reqinfo, void * requests);
+    void                        recordRequest(void * reqinfo, qint64 nsecs, int rc);
+    void                        recordRequestError(void * reqinfo);
+    void                        setRequestError(void * reqinfo, void * request, int error);
 
 private slots:
     /* SNMP agent event processing */
     void                        processEvents();
+    void                        processSocket(int socket);
+    void                        processTimeout();
+    void                        moveToOwnerThread();
+    void                        flushTraps();
 
 signals:
     /* Logging */
@@ -181,16 +654,121 @@ public:
      * success, or false to respond with a bad value error. */
     virtual bool                snmpSetValue(const QSNMPVar * var, const QVariant & v) = 0;
 
+    /* Multi-variable SET transaction hooks, optionally implemented in the user-derived class. */
+    virtual bool                snmpSetCheck(const QSNMPVar * var, const QVariant & v);
+    virtual void                snmpSetCommit(const QSNMPVar * var, const QVariant & v);
+    virtual bool                snmpSetUndo(const QSNMPVar * var, const QVariant & oldValue);
+
+    /* Get several variables' values at once, optionally implemented in the user-derived class.
+     * The default implementation calls snmpGetValue for each variable. */
+    virtual void                snmpGetValues(const QSNMPVarList & vars, QVector<QVariant> & values);
+
+    /* Get variable's value without QVariant, optionally implemented in the user-derived class.
+     * Return true (or the number of bytes written into buf) on success, or false (or -1) to fall
+     * back to snmpGetValue, which is what the default implementations do. */
+    virtual bool                snmpGetInt32(const QSNMPVar * var, qint32 & value);
+    virtual bool                snmpGetUInt32(const QSNMPVar * var, quint32 & value);
+    virtual bool                snmpGetUInt64(const QSNMPVar * var, quint64 & value);
+    virtual int                 snmpGetBytes(const QSNMPVar * var, char * buf, size_t cap);
+
+    /* Get variable's value later on, optionally implemented in the user-derived class. Return true to
+     * answer later via QSNMPAgent::completeRequest(token, ...), or false (default) to use snmpGetValue.
+     * Only called once enabled with snmpSetAsync. */
+    virtual bool                snmpGetValueAsync(const QSNMPVar * var, QSNMPRequestToken token);
+    bool                        snmpAsync() const;
+    void                        snmpSetAsync(bool async);
+
+    /* Value cache: time-to-live of the variables' values in milliseconds (0: disabled, default) */
+    int                         snmpCacheTtl() const;
+    void                        snmpSetCacheTtl(int ttlMs);
+    void                        snmpInvalidate();
+
+    /* Thread on which the above callbacks are called (through that object), when the agent runs on a worker thread */
+    QObject *                   snmpCallContext() const;
+    void                        snmpSetCallContext(QObject * context);
+
+    /* Stop the above callbacks, first thing in the destructor of the user-derived class (see ~QSNMPModule) */
+    void                        snmpDetach();
+
+    /* Statistics of the above get callbacks, recorded while the agent statistics are enabled (times in microseconds) */
+    QString                     snmpModuleName() const;
+    quint64                     snmpGetCalls() const;
+    quint64                     snmpGetTime() const;
+    quint64                     snmpGetMaxTime() const;
+    void                        snmpRecordGet(qint64 nsecs);
+
 protected:
     /* Add/Remove variables to/from this module */
     QSNMPVar *                  snmpCreateVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
                                               const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes = qsnmpScalarIndex);
     bool                        snmpDeleteVar(QSNMPVar * var);
+    int                         snmpDeleteVars(const QSNMPVarList & varList);
     void                        snmpDeleteAllVars();
 
+    /* Add variables bound to application memory, served without calling snmpGetValue/snmpSetValue */
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, qint32 * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, quint32 * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, quint64 * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, std::atomic<qint32> * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, std::atomic<quint32> * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+    QSNMPVar *                  snmpCreateBoundVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                                   const QSNMPOid & groupOid, quint32 fieldId, std::atomic<quint64> * value,
+                                                   const QSNMPOid & indexes = qsnmpScalarIndex, const QSNMPValidator & validator = QSNMPValidator());
+
 private:
+    QSNMPVar *                  snmpCreateVar(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                              const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes,
+                                              QSNMPBinding_e binding, void * value, const QSNMPValidator & validator);
+
     QSNMPAgent *                mSnmpAgent;
-    QSNMPVarList                mSnmpVarList;
+
+    /* Variables list in creation order, where deleted variables leave a hole (nullptr) until the list is
+     * compacted, that is when it is returned by snmpVarList or when holes make up half of it */
+    mutable QSNMPVarList        mSnmpVarList;
+    mutable int                 mSnmpVarHoles;
+    void                        snmpCompactVarList() const;
+
+    /* Variables indexes: position in the list and chain of the variables sharing a name (creation order),
+     * first and last variables per name, and variables per OID */
+    typedef struct
+    {
+        int                     index;
+        QSNMPVar *              prevSameName;
+        QSNMPVar *              nextSameName;
+    } VarEntry;
+    typedef struct
+    {
+        QSNMPVar *              first;
+        QSNMPVar *              last;
+    } NameEntry;
+    mutable QHash<QSNMPVar *, VarEntry> mSnmpVarEntries;
+    QHash<QString, NameEntry>   mSnmpVarNames;
+    QSNMPVarMap                 mSnmpVarOids;
+    void                        snmpIndexVar(QSNMPVar * var);
+    bool                        snmpUnindexVar(QSNMPVar * var);
+
+    /* Variables storage, see snmpFreeVar */
+    void                        snmpFreeVar(QSNMPVar * var);
+
+
+    QObject *                   mSnmpCallContext;
+    int                         mSnmpCacheTtl;
+    bool                        mSnmpAsync;
+
+    /* Get callbacks statistics */
+    std::atomic<quint64>        mSnmpGetCalls;
+    std::atomic<quint64>        mSnmpGetNsecs;
+    std::atomic<quint64>        mSnmpGetMaxNsecs;
 
 };
 
@@ -200,6 +778,39 @@ private:
 /******************** SNMP VARIABLE ********************/
 /*******************************************************/
 
+/* SNMPColumn class definition: the attributes shared by all the variables of a column
+ * (or by a scalar variable), stored once rather than in every variable */
+class QSNMPColumn
+{
+
+public:
+                                QSNMPColumn(const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
+                                            const QSNMPOid & groupOid, quint32 fieldId);
+
+    /* Getters */
+    const QString &             name() const;
+    QSNMPType_e                 type() const;
+    QSNMPMaxAccess_e            maxAccess() const;
+    const QSNMPOid &            groupOid() const;
+    quint32                     fieldId() const;
+    const QSNMPOid &            oid() const { return mOid; }
+
+    /* Reference counting, by the variables of the column (and the agent) */
+    void                        ref();
+    bool                        deref();
+
+private:
+    QString                     mName;
+    QSNMPType_e                 mType;
+    QSNMPMaxAccess_e            mMaxAccess;
+    QSNMPOid                    mGroupOid;
+    quint32                     mFieldId;
+    QSNMPOid                    mOid;
+    QAtomicInt                  mRefCount;
+
+    Q_DISABLE_COPY(QSNMPColumn)
+};
+
 /* SNMPVar class definition */
 class QSNMPVar
 {
@@ -207,44 +818,268 @@ class QSNMPVar
 public:
                                 QSNMPVar(QSNMPModule * module, const QString & name, QSNMPType_e type, QSNMPMaxAccess_e maxAccess,
                                              const QSNMPOid & groupOid, quint32 fieldId, const QSNMPOid & indexes = qsnmpScalarIndex);
+                                QSNMPVar(QSNMPModule * module, QSNMPColumn * column, const QSNMPOid & indexes = qsnmpScalarIndex);
     virtual                     ~QSNMPVar();
 
     /* Getters */
+    QSNMPColumn *               column() const;
     QSNMPModule *               module() const;
     const QString &             name() const;
     QSNMPType_e                 type() const;
     QSNMPMaxAccess_e            maxAccess() const;
     const QSNMPOid &            groupOid() const;
     quint32                     fieldId() const;
-    const QSNMPOid &            indexes() const;
-    const QSNMPOid &            oid() const;
-    const QString &             oidString() const;
-    const QString &             fullName() const;
+    QSNMPOid                    indexes() const;
+    int                         indexCount() const { return mIndexCount; }
+    quint32                     index(int k) const { return this->indexData()[k]; }
+    QSNMPOid                    oid() const;
+    QString                     oidString() const;
+    QString                     fullName() const;
+
+    /* OID ordering, without building the complete OID.
+     * Returns a negative value if this variable's OID is lower, 0 if equal, or a positive value if greater. */
+    int                         compare(const QSNMPVar * other) const;
+    template<typename T> int    compare(const T * arcs, size_t len) const;
 
-    /* Registration (opaque) */
-    void *                      registration() const;
-    void                        setRegistration(void * registration);
+    /* Bound value (see QSNMPModule::snmpCreateBoundVar) */
+    QSNMPBinding_e              binding() const;
+    void *                      boundValue() const;
+    void                        setBinding(QSNMPBinding_e binding, void * value, const QSNMPValidator & validator = QSNMPValidator());
 
     /* Value getter/setter */
     QVariant                    get() const;
+    bool                        check(const QVariant & v) const;
     bool                        set(const QVariant & v) const;
 
+    /* Value cache, as encoded SNMP data (see QSNMPModule::snmpSetCacheTtl) */
+    int                         cacheTtl() const;
+    void                        setCacheTtl(int ttlMs);
+    bool                        cachedValue(quint8 & asnType, QByteArray & value) const;
+    quint32                     cacheGeneration() const;
+    void                        setCachedValue(quint8 asnType, const void * data, size_t len, quint32 generation);
+    void                        invalidate();
+
 private:
-    /* Constants */
+    /* Constants: parent module, shared column attributes (including the column OID), and indexes
+     * (the complete OID and string representations are derived from them on demand) */
     QSNMPModule *               mModule;
-    QString                     mName;
-    QSNMPType_e                 mType;
-    QSNMPMaxAccess_e            mMaxAccess;
-    QSNMPOid                    mGroupOid;
-    quint32                     mFieldId;
-    QSNMPOid                    mIndexes;
-    QSNMPOid                    mOid;
-    QString                     mOidString;
-    QString                     mFullName;
+    QSNMPColumn *               mColumn;
+    int                         mIndexCount;
+    union
+    {
+        quint32                 mIndexInline[qsnmpVarInlineIndexes];
+        quint32 *               mIndexHeap;
+    };
+    const quint32 *             indexData() const { return (mIndexCount > qsnmpVarInlineIndexes) ? mIndexHeap : mIndexInline; }
+
+    /* Bound value and value cache, used by few variables and thus only allocated once set */
+    struct Extension;
+    std::atomic<Extension *>    mExtension;
+    Extension *                 extension();
+
+};
+
+
+
+/****************************************************/
+/******************** SNMP TABLE ********************/
+/****************************************************/
+
+/* SNMP table column (see QSNMPTable) */
+typedef struct
+{
+    quint32                     fieldId;
+    QString                     name;
+    QSNMPType_e                 type;
+    QSNMPMaxAccess_e            maxAccess;
+} QSNMPTableColumn;
+
+/* QSNMPRowIndex class definition: the indexes of a table's rows in lexicographic order, with O(log n)
+ * insertion, removal and successor lookup. It is locked, so that rows can be added or removed from any
+ * thread while the agent thread walks the table. */
+class QSNMPRowIndex
+{
+
+public:
+                                QSNMPRowIndex();
+
+    /* Rows */
+    int                         size() const;
+    bool                        contains(const QSNMPOid & index) const;
+    bool                        insert(const QSNMPOid & index);
+    bool                        remove(const QSNMPOid & index);
+    void                        clear();
+
+    /* Lexicographic order walk */
+    bool                        first(QSNMPOid & index) const;
+    bool                        next(const QSNMPOid & index, QSNMPOid & next) const;
+
+private:
+    mutable QMutex              mLock;
+    std::set<QSNMPOid>          mIndexes;
+
+    Q_DISABLE_COPY(QSNMPRowIndex)
+};
+
+/* QSNMPTable class definition: a table served straight from a user application data source, without any
+ * QSNMPVar per cell. The table is registered once as the subtree of its entry OID, and its cells
+ * (entryOid.fieldId.index) are resolved upon requests through the user-derived class callbacks. */
+class QSNMPTable
+{
+
+public:
+                                QSNMPTable(QSNMPAgent * snmpAgent, const QString & name, const QSNMPOid & entryOid,
+                                           const QList<QSNMPTableColumn> & columns);
+    virtual                     ~QSNMPTable();
+
+    /* Getters */
+    QSNMPAgent *                snmpAgent() const;
+    const QString &             snmpName() const;
+    const QSNMPOid &            snmpEntryOid() const;
+    const QList<QSNMPTableColumn> & snmpColumns() const;
+    const QSNMPTableColumn *    snmpColumn(quint32 fieldId) const;
+
+    /* Rows, optionally implemented in the user-derived class. Rows are walked in the lexicographic order of their
+     * indexes: snmpFirstIndex gives the index of the first row, snmpNextIndex the index of the row following 'index'
+     * (which is not necessarily the index of an existing row). Both return false if there is no such row.
+     * The default implementations walk the rows added with snmpAddRow. snmpRowCount is informational only,
+     * requests never rely on it, so that a data source may override the walk callbacks alone. */
+    virtual int                 snmpRowCount();
+    virtual bool                snmpFirstIndex(QSNMPOid & index);
+    virtual bool                snmpNextIndex(const QSNMPOid & index, QSNMPOid & next);
+    bool                        snmpHasRow(const QSNMPOid & index) const;
+
+    /* Get a cell's value, implemented in the user-derived class. Return an invalid QVariant if there is no such cell. */
+    virtual QVariant            snmpGetCell(const QSNMPOid & index, quint32 fieldId) = 0;
+
+    /* Set a cell's value, optionally implemented in the user-derived class for read-write columns. Return true
+     * on success, or false (default) to respond with a bad value error. */
+    virtual bool                snmpSetCell(const QSNMPOid & index, quint32 fieldId, const QVariant & v);
+
+    /* Thread on which the above callbacks are called (through that object), when the agent runs on a worker thread */
+    QObject *                   snmpCallContext() const;
+    void                        snmpSetCallContext(QObject * context);
+
+protected:
+    /* Add/Remove rows to/from the table's own row index (see snmpFirstIndex), from any thread */
+    bool                        snmpAddRow(const QSNMPOid & index);
+    bool                        snmpRemoveRow(const QSNMPOid & index);
+    void                        snmpClearRows();
+
+private:
+    QSNMPAgent *                mSnmpAgent;
+    QString                     mSnmpName;
+    QSNMPOid                    mSnmpEntryOid;
+    QList<QSNMPTableColumn>     mSnmpColumns;
+    QSNMPRowIndex               mSnmpRows;
+    QObject *                   mSnmpCallContext;
+
+    Q_DISABLE_COPY(QSNMPTable)
+};
+
+
+
+/***************************************************/
+/******************** SNMP TRAP ********************/
+/***************************************************/
+
+/* QSNMPTrap class definition, a pre-encoded trap template */
+class QSNMPTrap
+{
 
-    /* Registration (opaque) */
-    void *                      mRegistration;
+public:
+                                QSNMPTrap(QSNMPAgent * agent, const QString & name, const QSNMPOid & groupOid,
+                                          quint32 fieldId, const QSNMPVarList & varList = QSNMPVarList());
+    virtual                     ~QSNMPTrap();
+
+    /* Getters */
+    QSNMPAgent *                agent() const;
+    const QString &             name() const;
+    const QSNMPOid &            trapOid() const;
+    const QSNMPVarList &        varList() const;
+
+    /* Pre-encoded variable bindings (opaque), and the lock guarding them while refreshed and sent */
+    void *                      varbinds() const;
+    QMutex *                    varbindsLock() const;
+
+    /* Send trap with the variables' current values */
+    void                        send() const;
+
+private:
+    Q_DISABLE_COPY(QSNMPTrap)
+
+    QSNMPAgent *                mAgent;
+    QString                     mName;
+    QSNMPOid                    mTrapOid;
+    QSNMPVarList                mVarList;
+    void *                      mVarbinds;
+    mutable QMutex              mVarbindsLock;
 
 };
 
+
+
+/******************************************************************/
+/******************** TEMPLATE IMPLEMENTATIONS ********************/
+/******************************************************************/
+
+/* Lexicographic comparison of two OIDs given as raw arcs.
+ * Returns a negative value if a < b, 0 if a == b, or a positive value if a > b. */
+template<typename A, typename B> int qsnmpOidCompare(const A * a, size_t aLen, const B * b, size_t bLen)
+{
+    size_t len = qMin(aLen, bLen);
+    for(size_t k=0; k<len; k++)
+    {
+        if(a[k] != b[k])
+            return (a[k] < b[k]) ? -1 : 1;
+    }
+    return (aLen < bLen) ? -1 : ((aLen > bLen) ? 1 : 0);
+}
+
+/* Compares this variable's OID (column OID, then indexes) with an OID given as raw arcs. */
+template<typename T> int QSNMPVar::compare(const T * arcs, size_t len) const
+{
+    const QSNMPOid & columnOid = mColumn->oid();
+    size_t columnLen = columnOid.size();
+    if(len < columnLen)
+    {
+        int rc = qsnmpOidCompare(columnOid.constData(), len, arcs, len);
+        return rc ? rc : 1;
+    }
+    int rc = qsnmpOidCompare(columnOid.constData(), columnLen, arcs, columnLen);
+    return rc ? rc : qsnmpOidCompare(this->indexData(), mIndexCount, arcs + columnLen, len - columnLen);
+}
+
+/* Variable versus raw OID ordering */
+template<typename T> bool QSNMPVarOidLess::operator()(const QSNMPVar * a, const QSNMPOidKey<T> & b) const
+{
+    return a->compare(b.arcs, b.len) < 0;
+}
+template<typename T> bool QSNMPVarOidLess::operator()(const QSNMPOidKey<T> & a, const QSNMPVar * b) const
+{
+    return b->compare(a.arcs, a.len) > 0;
+}
+
+/* Returns the variable with the exact given OID, or nullptr if none found. */
+template<typename T> QSNMPVar * QSNMPVarMap::find(const T * arcs, size_t len) const
+{
+    QSNMPOidKey<T> key = { arcs, len };
+    Index::const_iterator it = mIndex.find(key);
+    return (it != mIndex.end()) ? *it : nullptr;
+}
+
+/* Returns an iterator to the first variable with an OID greater or equal to the given OID. */
+template<typename T> QSNMPVarMap::const_iterator QSNMPVarMap::lowerBound(const T * arcs, size_t len) const
+{
+    QSNMPOidKey<T> key = { arcs, len };
+    return const_iterator(mIndex.lower_bound(key));
+}
+
+/* Returns an iterator to the first variable with an OID strictly greater than the given OID. */
+template<typename T> QSNMPVarMap::const_iterator QSNMPVarMap::upperBound(const T * arcs, size_t len) const
+{
+    QSNMPOidKey<T> key = { arcs, len };
+    return const_iterator(mIndex.upper_bound(key));
+}
+
 #endif // QSNMP_H
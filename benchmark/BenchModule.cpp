@@ -0,0 +1,126 @@
+#include "BenchModule.h"
+#include <cstdio>
+
+/* Constructs a BenchModule object: 'scalars' Integer32 scalars under groupOid.1, and a table of 'rows'
+ * rows under groupOid.2.1 (indexes 'firstRow' to 'firstRow'+'rows'-1). A 'typed' module serves its values
+ * through the typed getters, otherwise through snmpGetValue. */
+BenchModule::BenchModule(QSNMPAgent * snmpAgent, const QSNMPOid & groupOid, int scalars, int rows, bool typed, int firstRow) : QSNMPModule(snmpAgent)
+{
+    /* Store local parameters */
+    mScalarsOid = QSNMPOid() << groupOid << 1;
+    mEntryOid = QSNMPOid() << groupOid << 2 << 1;
+    mTyped = typed;
+    mFirstRow = firstRow;
+
+    /* Initialize synthetic values */
+    mScalars.resize(scalars);
+    mIntegers.resize(rows);
+    mCounters.resize(rows);
+    for(int k=0; k<scalars; k++)
+        mScalars[k] = k;
+    for(int k=0; k<rows; k++)
+    {
+        mIntegers[k] = k;
+        mCounters[k] = (quint64)k << 32;
+    }
+
+    /* Create SNMP variables, registered at once */
+    snmpAgent->beginBatch();
+    for(int k=0; k<scalars; k++)
+        this->snmpCreateVar("benchScalar", QSNMPType_Integer, QSNMPMaxAccess_ReadWrite, mScalarsOid, k+1);
+    for(int k=0; k<rows; k++)
+    {
+        QSNMPOid indexes = QSNMPOid() << (quint32)(mFirstRow+k);
+        this->snmpCreateVar("benchInteger", QSNMPType_Integer, QSNMPMaxAccess_ReadWrite, mEntryOid, 1, indexes);
+        this->snmpCreateVar("benchString", QSNMPType_OctetStr, QSNMPMaxAccess_ReadOnly, mEntryOid, 2, indexes);
+        this->snmpCreateVar("benchCounter", QSNMPType_Counter64, QSNMPMaxAccess_ReadOnly, mEntryOid, 3, indexes);
+    }
+    snmpAgent->commitBatch();
+}
+
+/* BenchModule destructor. */
+BenchModule::~BenchModule()
+{
+    /* Unregister and free the SNMP variables before the members they read are destroyed, as the agent may
+     * call this module from its own thread in worker mode (see QSNMPModule::snmpDetach). */
+    this->snmpDetach();
+}
+
+/* Returns the value associated to SNMP variable var (in order to respond to a SNMP GET request). */
+QVariant BenchModule::snmpGetValue(const QSNMPVar * var)
+{
+    int k = (int)var->index(0) - mFirstRow;
+    if(var->groupOid() == mScalarsOid)
+        return QVariant(mScalars.value((int)var->fieldId()-1));
+    switch(var->fieldId())
+    {
+    case 1: /* benchInteger: Integer32 */
+        return QVariant(mIntegers.value(k));
+    case 2: /* benchString: DisplayString */
+        return QVariant(QString("row-%1").arg(mFirstRow+k));
+    case 3: /* benchCounter: Counter64 */
+        return QVariant(mCounters.value(k));
+    default:
+        break;
+    }
+    return QVariant();
+}
+
+/* Sets the value associated to SNMP variable var (in order to fulfil a SNMP SET request). */
+bool BenchModule::snmpSetValue(const QSNMPVar * var, const QVariant & v)
+{
+    int k = (int)var->index(0) - mFirstRow;
+    if(var->groupOid() == mScalarsOid)
+    {
+        mScalars[(int)var->fieldId()-1] = v.value<qint32>();
+        return true;
+    }
+    if(var->fieldId() == 1)
+    {
+        mIntegers[k] = v.value<qint32>();
+        return true;
+    }
+    return false;
+}
+
+/* Typed getter for the Integer32 scalars and column. */
+bool BenchModule::snmpGetInt32(const QSNMPVar * var, qint32 & value)
+{
+    if(!mTyped)
+        return false;
+    int k = (int)var->index(0) - mFirstRow;
+    value = (var->groupOid() == mScalarsOid) ? mScalars.value((int)var->fieldId()-1) : mIntegers.value(k);
+    return true;
+}
+
+/* Typed getter for the Counter64 column. */
+bool BenchModule::snmpGetUInt64(const QSNMPVar * var, quint64 & value)
+{
+    if(!mTyped)
+        return false;
+    value = mCounters.value((int)var->index(0) - mFirstRow);
+    return true;
+}
+
+/* Typed getter for the DisplayString column, falls back to snmpGetValue if the string does not fit. */
+int BenchModule::snmpGetBytes(const QSNMPVar * var, char * buf, size_t cap)
+{
+    if(!mTyped)
+        return -1;
+    int len = snprintf(buf, cap, "row-%u", var->index(0));
+    if((len < 0) || ((size_t)len >= cap))
+        return -1;
+    return len;
+}
+
+/* Returns the OID of the group of scalars. */
+const QSNMPOid & BenchModule::scalarsOid() const
+{
+    return mScalarsOid;
+}
+
+/* Returns the OID of the table entry. */
+const QSNMPOid & BenchModule::entryOid() const
+{
+    return mEntryOid;
+}
@@ -0,0 +1,44 @@
+#ifndef BENCHMODULE_H
+#define BENCHMODULE_H
+
+#include "../QSNMP/QSNMP.h"
+
+
+
+/* BenchModule class definition: a synthetic MIB module made of scalars and of a large table
+ * with an Integer32 (read-write), a DisplayString and a Counter64 column, or of some rows only */
+class BenchModule : public QObject, public QSNMPModule
+{ Q_OBJECT
+
+public:
+                                BenchModule(QSNMPAgent * snmpAgent, const QSNMPOid & groupOid, int scalars, int rows, bool typed, int firstRow = 1);
+    virtual                     ~BenchModule();
+
+    /* SNMP module get/set variable value implementation */
+    virtual QVariant            snmpGetValue(const QSNMPVar * var);
+    virtual bool                snmpSetValue(const QSNMPVar * var, const QVariant & v);
+
+    /* Typed getters, only used when the module is 'typed' */
+    virtual bool                snmpGetInt32(const QSNMPVar * var, qint32 & value);
+    virtual bool                snmpGetUInt64(const QSNMPVar * var, quint64 & value);
+    virtual int                 snmpGetBytes(const QSNMPVar * var, char * buf, size_t cap);
+
+    /* OIDs */
+    const QSNMPOid &            scalarsOid() const;
+    const QSNMPOid &            entryOid() const;
+
+private:
+    /* Local parameters */
+    QSNMPOid                    mScalarsOid;
+    QSNMPOid                    mEntryOid;
+    bool                        mTyped;
+    int                         mFirstRow;
+
+    /* Synthetic values, per scalar and per row */
+    QVector<qint32>             mScalars;
+    QVector<qint32>             mIntegers;
+    QVector<quint64>            mCounters;
+
+};
+
+#endif // BENCHMODULE_H
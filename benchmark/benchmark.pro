@@ -0,0 +1,18 @@
+# Application
+TARGET  = benchmark
+QT      += core
+QT      -= gui
+CONFIG  += c++14
+
+# NET-SNMP library linkage
+LIBS += -lnetsnmp -lnetsnmpagent
+
+# Source files
+SOURCES += \
+    ../QSNMP/QSNMP.cpp \
+    BenchModule.cpp \
+    main.cpp
+
+HEADERS += \
+    ../QSNMP/QSNMP.h \
+    BenchModule.h
@@ -0,0 +1,204 @@
+#!/bin/bash
+###########################################################################
+#
+# loadtest.sh - end-to-end load test of QSNMP against a local snmpd
+#
+# Starts a private snmpd master agent (see snmpd.conf) on a UNIX-domain
+# AgentX socket, then for each table size runs the benchmark application
+# as a sub-agent (benchmark -l) and drives concurrent snmpget, snmpset and
+# snmpbulkwalk clients over loopback for a while. Reports the startup
+# registration time, the sub-agent RSS, the requests/s and the latency
+# percentiles per request type.
+#
+# Latencies are measured around each client command, and thus include the
+# client process startup: the 'baseline' line gives the latency of a GET
+# served by snmpd itself (sysUpTime.0), to be subtracted.
+#
+# Requires the Net-SNMP daemon and command line applications.
+#
+###########################################################################
+
+usage()
+{
+    cat <<EOF
+Usage: $0 [options] [-- benchmark options]
+  -r "rows..."   table sizes to test (default: "$ROWS")
+  -c clients     concurrent clients per request type (default: $CLIENTS)
+  -d seconds     load duration per table size (default: $DURATION)
+  -n varbinds    varbinds per GET/SET PDU (default: $VARBINDS)
+  -p port        snmpd UDP port on 127.0.0.1 (default: $PORT)
+  -b benchmark   benchmark application (default: $BENCH)
+Benchmark options (e.g. -g, -t, -s) are passed to each sub-agent.
+EOF
+    exit 1
+}
+
+# Default parameters
+ROWS="1000 10000 100000"
+CLIENTS=4
+DURATION=10
+VARBINDS=10
+PORT=16161
+BENCH=$(dirname "$0")/benchmark
+SNMPD=${SNMPD:-$(command -v snmpd || echo /usr/sbin/snmpd)}
+GROUP_OID=1.3.6.1.4.1.99999.1
+ENTRY_OID=$GROUP_OID.2.1
+
+# Parse arguments
+while getopts "r:c:d:n:p:b:h" opt; do
+    case $opt in
+        r) ROWS=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        d) DURATION=$OPTARG ;;
+        n) VARBINDS=$OPTARG ;;
+        p) PORT=$OPTARG ;;
+        b) BENCH=$OPTARG ;;
+        *) usage ;;
+    esac
+done
+shift $((OPTIND-1))
+BENCH_ARGS=("$@")
+for tool in "$SNMPD" snmpget snmpset snmpbulkwalk; do
+    if ! command -v "$tool" > /dev/null; then
+        echo "$tool not found, please install the Net-SNMP software suite" >&2
+        exit 1
+    fi
+done
+if [ ! -x "$BENCH" ]; then
+    echo "$BENCH not found, please build the benchmark application first" >&2
+    exit 1
+fi
+SNMP_OPTS=(-v2c -t 5 -r 0 -Oqn)
+TARGET=127.0.0.1:$PORT
+
+# Private working directory, removed on exit along with the processes started
+WORKDIR=$(mktemp -d /tmp/qsnmp-loadtest.XXXXXX)
+SNMPD_PID=
+AGENT_PID=
+cleanup()
+{
+    [ -n "$AGENT_PID" ] && kill "$AGENT_PID" 2> /dev/null && wait "$AGENT_PID" 2> /dev/null
+    [ -n "$SNMPD_PID" ] && kill "$SNMPD_PID" 2> /dev/null && wait "$SNMPD_PID" 2> /dev/null
+    rm -rf "$WORKDIR"
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# Waits (up to $2 seconds) until command $1 succeeds
+wait_for()
+{
+    local k
+    for ((k=0; k<$2*10; k++)); do
+        eval "$1" && return 0
+        sleep 0.1
+    done
+    return 1
+}
+
+# Returns a random row index, from 1 to $1
+random_row()
+{
+    echo $(( ((RANDOM << 15) | RANDOM) % $1 + 1 ))
+}
+
+# Client loop for request type $1 against a table of $2 rows, logs "<latency us> <rc> <varbinds>" to file $3
+client()
+{
+    local kind=$1 rows=$2 log=$3 end=$((SECONDS + DURATION))
+    local args k t0 t1 rc output
+    while [ $SECONDS -lt $end ]; do
+        args=()
+        case $kind in
+            baseline)
+                args=(snmpget "${SNMP_OPTS[@]}" -c public "$TARGET" 1.3.6.1.2.1.1.3.0) ;;
+            get)
+                args=(snmpget "${SNMP_OPTS[@]}" -c public "$TARGET")
+                for ((k=0; k<VARBINDS; k++)); do
+                    args+=("$ENTRY_OID.$((RANDOM % 3 + 1)).$(random_row "$rows")")
+                done ;;
+            set)
+                args=(snmpset "${SNMP_OPTS[@]}" -c private "$TARGET")
+                for ((k=0; k<VARBINDS; k++)); do
+                    args+=("$ENTRY_OID.1.$(random_row "$rows")" i $((RANDOM % 1000)))
+                done ;;
+            walk)
+                args=(snmpbulkwalk "${SNMP_OPTS[@]}" -Cr25 -c public "$TARGET" "$ENTRY_OID.$((RANDOM % 3 + 1))") ;;
+        esac
+        t0=$(date +%s%N)
+        output=$("${args[@]}" 2> /dev/null)
+        rc=$?
+        t1=$(date +%s%N)
+        echo "$(( (t1 - t0) / 1000 )) $rc $(grep -c . <<< "$output")" >> "$log"
+    done
+}
+
+# Prints "<requests/s> <p50 ms> <p99 ms> <varbinds/s> <errors>" from the logs of a request type
+report()
+{
+    cat "$@" 2> /dev/null | sort -n | awk -v duration="$DURATION" '
+        $2 != 0 { errors++; next }
+        { latency[++count] = $1; varbinds += $3 }
+        END {
+            if(count == 0) { printf "0 - - 0 %d\n", errors; exit }
+            printf "%.1f %.1f %.1f %d %d\n", count / duration, latency[int((count-1)*0.50)+1] / 1000,
+                   latency[int((count-1)*0.99)+1] / 1000, varbinds / duration, errors
+        }'
+}
+
+# Start the master agent
+sed -e "s|@WORKDIR@|$WORKDIR|g" -e "s|@PORT@|$PORT|g" "$(dirname "$0")/snmpd.conf" > "$WORKDIR/snmpd.conf"
+SNMP_PERSISTENT_DIR=$WORKDIR "$SNMPD" -f -C -c "$WORKDIR/snmpd.conf" -Lf "$WORKDIR/snmpd.log" &
+SNMPD_PID=$!
+if ! wait_for "[ -S '$WORKDIR/agentx' ]" 10; then
+    echo "snmpd failed to start, see below:" >&2
+    cat "$WORKDIR/snmpd.log" >&2
+    exit 1
+fi
+
+# Client latency baseline, against snmpd itself
+rm -f "$WORKDIR"/*.lat
+client baseline 1 "$WORKDIR/baseline.lat"
+read -r rate p50 p99 vbs errors <<< "$(report "$WORKDIR/baseline.lat")"
+echo "baseline: $rate GET/s, p50 $p50 ms, p99 $p99 ms (single client, served by snmpd)"
+echo
+
+# Load test per table size
+printf "%9s %9s %10s %9s %9s | %8s %7s %7s | %8s %7s %7s | %7s %10s | %6s\n" \
+       rows vars reg_ms rss_kB load_kB get/s p50_ms p99_ms set/s p50_ms p99_ms walk/s varbinds/s errors
+for rows in $ROWS; do
+    # Start the sub-agent and wait for its registrations to complete
+    "$BENCH" -l -r "$rows" -x "unix:$WORKDIR/agentx" "${BENCH_ARGS[@]}" > "$WORKDIR/agent.log" 2>&1 &
+    AGENT_PID=$!
+    if ! wait_for "grep -q '^ready' '$WORKDIR/agent.log' || ! kill -0 $AGENT_PID 2> /dev/null" 3600 \
+       || ! grep -q '^ready' "$WORKDIR/agent.log"; then
+        echo "sub-agent failed to start, see below:" >&2
+        cat "$WORKDIR/agent.log" >&2
+        exit 1
+    fi
+    vars=$(awk '/variables/ { print $1 }' "$WORKDIR/agent.log")
+    reg_ms=$(awk '/^create/ { print $2 }' "$WORKDIR/agent.log")
+    rss_kb=$(awk '/^ready/ { print $2 }' "$WORKDIR/agent.log")
+
+    # Drive concurrent clients of each request type
+    rm -f "$WORKDIR"/*.lat
+    for kind in get set walk; do
+        for ((c=0; c<CLIENTS; c++)); do
+            client $kind "$rows" "$WORKDIR/$kind.$c.lat" &
+        done
+    done
+    wait $(jobs -p | grep -v -e "^$SNMPD_PID\$" -e "^$AGENT_PID\$")
+    load_kb=$(awk '/^VmRSS/ { print $2 }' "/proc/$AGENT_PID/status" 2> /dev/null)
+
+    # Report
+    read -r get_rate get_p50 get_p99 get_vbs get_errors <<< "$(report "$WORKDIR"/get.*.lat)"
+    read -r set_rate set_p50 set_p99 set_vbs set_errors <<< "$(report "$WORKDIR"/set.*.lat)"
+    read -r walk_rate walk_p50 walk_p99 walk_vbs walk_errors <<< "$(report "$WORKDIR"/walk.*.lat)"
+    printf "%9s %9s %10s %9s %9s | %8s %7s %7s | %8s %7s %7s | %7s %10s | %6s\n" \
+           "$rows" "$vars" "$reg_ms" "$rss_kb" "${load_kb:--}" "$get_rate" "$get_p50" "$get_p99" \
+           "$set_rate" "$set_p50" "$set_p99" "$walk_rate" "$walk_vbs" $((get_errors + set_errors + walk_errors))
+
+    # Stop the sub-agent
+    kill "$AGENT_PID" 2> /dev/null
+    wait "$AGENT_PID" 2> /dev/null
+    AGENT_PID=
+done
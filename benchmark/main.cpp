@@ -0,0 +1,546 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QElapsedTimer>
+#include <QTextStream>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <signal.h>
+#include <unistd.h>
+#include <net-snmp/net-snmp-config.h>
+#include <net-snmp/net-snmp-includes.h>
+#include <net-snmp/agent/net-snmp-agent-includes.h>
+#include "../QSNMP/QSNMP.h"
+#include "BenchModule.h"
+
+
+
+/*************************************************************/
+/******************** ALLOCATION COUNTING ********************/
+/*************************************************************/
+
+/* Heap allocations are counted by wrapping the C allocator, so that Qt containers, Net-SNMP and
+ * operator new are all accounted for. Only available with the GNU C library, which exports its
+ * allocator under the __libc_ names. */
+#ifdef __GLIBC__
+#include <malloc.h>
+#define BENCH_COUNT_ALLOCS 1
+
+extern "C" void * __libc_malloc(size_t size);
+extern "C" void * __libc_calloc(size_t count, size_t size);
+extern "C" void * __libc_realloc(void * ptr, size_t size);
+extern "C" void * __libc_memalign(size_t alignment, size_t size);
+extern "C" void   __libc_free(void * ptr);
+
+static std::atomic<quint64> benchAllocCalls(0);
+static std::atomic<qint64> benchLiveBytes(0);
+
+/* Accounts for a new block */
+static inline void * countAlloc(void * ptr)
+{
+    if(ptr)
+    {
+        benchAllocCalls.fetch_add(1, std::memory_order_relaxed);
+        benchLiveBytes.fetch_add((qint64)malloc_usable_size(ptr), std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+/* Accounts for a freed block */
+static inline void countFree(void * ptr)
+{
+    if(ptr)
+        benchLiveBytes.fetch_sub((qint64)malloc_usable_size(ptr), std::memory_order_relaxed);
+}
+
+extern "C" void * malloc(size_t size) noexcept
+{
+    return countAlloc(__libc_malloc(size));
+}
+
+extern "C" void * calloc(size_t count, size_t size) noexcept
+{
+    return countAlloc(__libc_calloc(count, size));
+}
+
+extern "C" void * realloc(void * ptr, size_t size) noexcept
+{
+    countFree(ptr);
+    void * newPtr = __libc_realloc(ptr, size);
+    if(!newPtr && ptr && size)
+    {
+        /* Failed, the block is left untouched */
+        benchLiveBytes.fetch_add((qint64)malloc_usable_size(ptr), std::memory_order_relaxed);
+        return nullptr;
+    }
+    return countAlloc(newPtr);
+}
+
+extern "C" void * memalign(size_t alignment, size_t size) noexcept
+{
+    return countAlloc(__libc_memalign(alignment, size));
+}
+
+extern "C" void * aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    return countAlloc(__libc_memalign(alignment, size));
+}
+
+extern "C" int posix_memalign(void ** ptr, size_t alignment, size_t size) noexcept
+{
+    *ptr = countAlloc(__libc_memalign(alignment, size));
+    return *ptr ? 0 : ENOMEM;
+}
+
+extern "C" void free(void * ptr) noexcept
+{
+    countFree(ptr);
+    __libc_free(ptr);
+}
+#endif
+
+/* Returns the number of heap allocations so far */
+static quint64 allocCalls()
+{
+#ifdef BENCH_COUNT_ALLOCS
+    return benchAllocCalls.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+/* Returns the number of heap bytes currently allocated */
+static qint64 liveBytes()
+{
+#ifdef BENCH_COUNT_ALLOCS
+    return benchLiveBytes.load(std::memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+/* Returns the resident set size of the process, in bytes */
+static qint64 residentBytes()
+{
+    long pages = 0;
+    long resident = 0;
+    FILE * f = fopen("/proc/self/statm", "r");
+    if(!f)
+        return 0;
+    if(fscanf(f, "%ld %ld", &pages, &resident) != 2)
+        resident = 0;
+    fclose(f);
+    return (qint64)resident * sysconf(_SC_PAGESIZE);
+}
+
+
+
+/********************************************************/
+/******************** SYNTHETIC PDUS ********************/
+/********************************************************/
+
+/* A synthetic PDU: a chain of Net-SNMP requests along with their varbinds, built once and reused
+ * by every handler call so that only the agent's own work is measured */
+class BenchPdu
+{
+
+public:
+                                BenchPdu(int size);
+                                ~BenchPdu();
+
+    /* Request reset before a new handler call */
+    void                        set(int k, const QSNMPOid & qtOid, u_char type = ASN_NULL, const void * value = nullptr, size_t len = 0);
+    void                        reset(int k);
+
+    /* Requests */
+    int                         size() const;
+    netsnmp_request_info *      requests();
+    netsnmp_request_info &      request(int k);
+
+private:
+    netsnmp_variable_list *     mVarList;
+    QVector<netsnmp_request_info>
+                                mRequests;
+
+};
+
+/* Constructs a PDU of 'size' NULL varbinds. */
+BenchPdu::BenchPdu(int size)
+{
+    mVarList = nullptr;
+    for(int k=0; k<size; k++)
+        snmp_varlist_add_variable(&mVarList, nullptr, 0, ASN_NULL, nullptr, 0);
+    mRequests.resize(size);
+    memset(mRequests.data(), 0, size * sizeof(netsnmp_request_info));
+    netsnmp_variable_list * varbind = mVarList;
+    for(int k=0; k<size; k++, varbind = varbind->next_variable)
+    {
+        mRequests[k].requestvb = varbind;
+        mRequests[k].next = (k+1 < size) ? &mRequests[k+1] : nullptr;
+        mRequests[k].prev = (k > 0) ? &mRequests[k-1] : nullptr;
+    }
+}
+
+/* PDU destructor. */
+BenchPdu::~BenchPdu()
+{
+    snmp_free_varbind(mVarList);
+}
+
+/* Resets request k before a new handler call, with the given OID and value. */
+void BenchPdu::set(int k, const QSNMPOid & qtOid, u_char type, const void * value, size_t len)
+{
+    oid snmpOid[MAX_OID_LEN];
+    for(int i=0; i<qtOid.size(); i++)
+        snmpOid[i] = qtOid[i];
+    netsnmp_request_info & request = mRequests[k];
+    snmp_set_var_objid(request.requestvb, snmpOid, qtOid.size());
+    snmp_set_var_typed_value(request.requestvb, type, value, len);
+    request.processed = 0;
+    request.status = 0;
+    request.inclusive = 0;
+}
+
+/* Resets request k before a new handler call, keeping its OID (i.e. the OID returned by a GETNEXT). */
+void BenchPdu::reset(int k)
+{
+    netsnmp_request_info & request = mRequests[k];
+    snmp_set_var_typed_value(request.requestvb, ASN_NULL, nullptr, 0);
+    request.processed = 0;
+    request.status = 0;
+}
+
+/* Returns the number of requests of the PDU. */
+int BenchPdu::size() const
+{
+    return mRequests.size();
+}
+
+/* Returns the chain of requests, as passed to the handler. */
+netsnmp_request_info * BenchPdu::requests()
+{
+    return mRequests.data();
+}
+
+/* Returns request k. */
+netsnmp_request_info & BenchPdu::request(int k)
+{
+    return mRequests[k];
+}
+
+/* Calls the agent's handler as the Net-SNMP library would, for all the requests of a PDU */
+static int callHandler(QSNMPAgent * agent, netsnmp_handler_registration * reginfo, int mode, BenchPdu & pdu)
+{
+    netsnmp_agent_request_info reqinfo;
+    memset(&reqinfo, 0, sizeof(reqinfo));
+    reqinfo.mode = mode;
+    return agent->handler(nullptr, reginfo, &reqinfo, pdu.requests());
+}
+
+/* Small deterministic pseudo-random generator (xorshift), so that runs are comparable */
+static quint32 benchRandom()
+{
+    static quint32 state = 2463534242u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/* Measurement of a benchmark scenario */
+typedef struct
+{
+    quint64 varbinds;
+    quint64 allocs;
+    qint64  nsecs;
+    int     errors;
+} BenchResult;
+
+/* Prints the result of a scenario */
+static void printResult(QTextStream & out, const QString & name, const BenchResult & result)
+{
+    double seconds = result.nsecs / 1e9;
+    out << QString("%1 %2 varbinds/s, %3 us/varbind, %4 allocs/varbind%5\n")
+           .arg(name, -12)
+           .arg(seconds > 0 ? (qint64)(result.varbinds / seconds) : 0, 10)
+           .arg(result.varbinds ? result.nsecs / 1e3 / result.varbinds : 0.0, 0, 'f', 3)
+#ifdef BENCH_COUNT_ALLOCS
+           .arg(result.varbinds ? (double)result.allocs / result.varbinds : 0.0, 0, 'f', 2)
+#else
+           .arg("n/a")
+#endif
+           .arg(result.errors ? QString(", %1 errors").arg(result.errors) : QString());
+    out.flush();
+}
+
+
+
+/**********************************************************/
+/******************** STATIC FUNCTIONS ********************/
+/**********************************************************/
+
+/* Signal caught callback: quit application */
+static void terminate(int signum)
+{
+    Q_UNUSED(signum)
+    QCoreApplication::quit();
+}
+
+
+
+/**********************************************************/
+/******************** MAIN ENTRY POINT ********************/
+/**********************************************************/
+
+int main(int argc, char * argv[])
+{
+    /* Setup Qt application */
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Qt-SNMP AgentX sub-agent benchmark");
+
+    /* Parse application arguments */
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QString("%1 -- Measures the QSNMP request handler with synthetic PDUs, "
+                                             "no master agent needed.").arg(QCoreApplication::applicationName()));
+    parser.addHelpOption();
+    QCommandLineOption rowsOption(QStringList() << "r", "Sets the number of table rows (3 variables per row).", "rows", "10000");
+    parser.addOption(rowsOption);
+    QCommandLineOption scalarsOption(QStringList() << "s", "Sets the number of scalars.", "scalars", "100");
+    parser.addOption(scalarsOption);
+    QCommandLineOption pduOption(QStringList() << "p", "Sets the number of varbinds per GET/SET PDU.", "varbinds", "10");
+    parser.addOption(pduOption);
+    QCommandLineOption iterationsOption(QStringList() << "i", "Sets the number of PDUs per GET/SET scenario.", "count", "100000");
+    parser.addOption(iterationsOption);
+    QCommandLineOption typedOption(QStringList() << "t", "Serves values through the typed getters instead of snmpGetValue.");
+    parser.addOption(typedOption);
+    QCommandLineOption groupOption(QStringList() << "g", "Uses group registrations instead of instance registrations.");
+    parser.addOption(groupOption);
+    QCommandLineOption rowModulesOption(QStringList() << "e", "Creates a module per table row (as example/MyTableEntry) instead of a single module.");
+    parser.addOption(rowModulesOption);
+    QCommandLineOption statsOption(QStringList() << "m", "Enables the agent self-monitoring statistics.");
+    parser.addOption(statsOption);
+    QCommandLineOption agentAddrOption(QStringList() << "x", "Sets the SNMP AgentX socket address, no master agent is needed.",
+                                       "agentxsocket", "unix:/nonexistent/qsnmp-benchmark");
+    parser.addOption(agentAddrOption);
+    QCommandLineOption serveOption(QStringList() << "l", "Serves the module to the master agent until terminated instead of "
+                                   "running the handler scenarios (see loadtest.sh).");
+    parser.addOption(serveOption);
+    parser.process(app);
+    int rows = qMax(1, parser.value(rowsOption).toInt());
+    int scalars = qMax(1, parser.value(scalarsOption).toInt());
+    int pduSize = qMax(1, parser.value(pduOption).toInt());
+    int iterations = qMax(1, parser.value(iterationsOption).toInt());
+    int vars = scalars + 3*rows;
+    bool typed = parser.isSet(typedOption);
+    bool rowModules = parser.isSet(rowModulesOption);
+    QTextStream out(stdout);
+
+    /* Initialize SNMP agent, which stays disconnected from any master agent unless serving */
+    bool serve = parser.isSet(serveOption);
+    if(!serve)
+        netsnmp_ds_set_boolean(NETSNMP_DS_APPLICATION_ID, NETSNMP_DS_AGENT_NO_CONNECTION_WARNINGS, 1);
+    QSNMPAgent * snmpAgent = new QSNMPAgent("benchmark", parser.value(agentAddrOption));
+    snmpAgent->setLogMask(0);
+    snmpAgent->setRegistrationMode(parser.isSet(groupOption) ? QSNMPRegistration_Group : QSNMPRegistration_Instance);
+    snmpAgent->setStatisticsEnabled(parser.isSet(statsOption));
+
+    /* Create the module(s), measuring registration time and memory: either a single module holding
+     * the scalars and the whole table, or a module holding the scalars and a module per table row */
+    QSNMPOid groupOid = QSNMPOid() << 1 << 3 << 6 << 1 << 4 << 1 << 99999 << 1;
+    qint64 heapBefore = liveBytes();
+    qint64 rssBefore = residentBytes();
+    QElapsedTimer timer;
+    timer.start();
+    BenchModule * module = nullptr;
+    QVector<BenchModule *> rowModule;
+    if(rowModules)
+    {
+        snmpAgent->beginBatch();
+        module = new BenchModule(snmpAgent, groupOid, scalars, 0, typed);
+        rowModule.resize(rows);
+        for(int k=0; k<rows; k++)
+            rowModule[k] = new BenchModule(snmpAgent, groupOid, 0, 1, typed, k+1);
+        snmpAgent->commitBatch();
+    }
+    else
+        module = new BenchModule(snmpAgent, groupOid, scalars, rows, typed);
+    qint64 createNsecs = timer.nsecsElapsed();
+    qint64 heapPerVar = (liveBytes() - heapBefore) / vars;
+    qint64 rssPerVar = (residentBytes() - rssBefore) / vars;
+    out << QString("%1 variables (%2 scalars, %3 rows), %4 registrations, %5\n")
+           .arg(vars).arg(scalars).arg(rows).arg(parser.isSet(groupOption) ? "group" : "instance")
+           .arg(rowModules ? "a module per row" : "a single module");
+    out << QString("create       %1 ms, %2 us/var\n").arg(createNsecs / 1e6, 0, 'f', 1).arg(createNsecs / 1e3 / vars, 0, 'f', 3);
+#ifdef BENCH_COUNT_ALLOCS
+    out << QString("memory       %1 heap bytes/var, %2 RSS bytes/var\n").arg(heapPerVar).arg(rssPerVar);
+#else
+    out << QString("memory       n/a heap bytes/var, %1 RSS bytes/var\n").arg(rssPerVar);
+#endif
+    out.flush();
+
+    /* Serve the module to the master agent: registration time above includes the AgentX round trips */
+    if(serve)
+    {
+        struct sigaction action;
+        memset(&action, 0, sizeof(struct sigaction));
+        action.sa_handler = terminate;
+        sigaction(SIGHUP, &action, NULL);
+        sigaction(SIGINT, &action, NULL);
+        sigaction(SIGTERM, &action, NULL);
+        out << QString("ready        %1 kB RSS\n").arg(residentBytes() / 1024);
+        out.flush();
+        int rc = app.exec();
+        qDeleteAll(rowModule);
+        delete module;
+        delete snmpAgent;
+        return rc;
+    }
+
+    /* Registration passed to the handler: the module's subtree, as for a group registration */
+    oid rootOid[MAX_OID_LEN];
+    for(int k=0; k<groupOid.size(); k++)
+        rootOid[k] = groupOid[k];
+    netsnmp_handler_registration reginfo;
+    memset(&reginfo, 0, sizeof(reginfo));
+    reginfo.rootoid = rootOid;
+    reginfo.rootoid_len = groupOid.size();
+
+    /* GET: PDUs of random table cells */
+    {
+        BenchPdu pdu(pduSize);
+        BenchResult result = { 0, 0, 0, 0 };
+        for(int i=0; i<iterations; i++)
+        {
+            for(int k=0; k<pdu.size(); k++)
+                pdu.set(k, QSNMPOid() << module->entryOid() << (1 + benchRandom() % 3) << (1 + benchRandom() % rows));
+            quint64 allocs = allocCalls();
+            timer.restart();
+            if(callHandler(snmpAgent, &reginfo, MODE_GET, pdu) != SNMP_ERR_NOERROR)
+                result.errors++;
+            result.nsecs += timer.nsecsElapsed();
+            result.allocs += allocCalls() - allocs;
+            result.varbinds += pdu.size();
+        }
+        printResult(out, "get", result);
+    }
+
+    /* GETNEXT: walk of the whole module, a varbind per PDU (snmpwalk) */
+    {
+        BenchPdu pdu(1);
+        BenchResult result = { 0, 0, 0, 0 };
+        pdu.set(0, groupOid);
+        for(;;)
+        {
+            netsnmp_variable_list * varbind = pdu.request(0).requestvb;
+            size_t nameLength = varbind->name_length;
+            oid lastArc = varbind->name[nameLength-1];
+            pdu.reset(0);
+            quint64 allocs = allocCalls();
+            timer.restart();
+            if(callHandler(snmpAgent, &reginfo, MODE_GETNEXT, pdu) != SNMP_ERR_NOERROR)
+                result.errors++;
+            result.nsecs += timer.nsecsElapsed();
+            result.allocs += allocCalls() - allocs;
+
+            /* The end of the subtree is reached when the request is left untouched */
+            if((varbind->name_length == nameLength) && (varbind->name[nameLength-1] == lastArc) && (varbind->type == ASN_NULL))
+                break;
+            result.varbinds++;
+        }
+        printResult(out, "walk", result);
+        if(result.varbinds != (quint64)vars)
+            out << QString("warning: walked %1 variables out of %2\n").arg(result.varbinds).arg(vars);
+    }
+
+    /* GETNEXT: walk of the table, a varbind per column per PDU (snmptable, GETBULK repetitions) */
+    {
+        BenchPdu pdu(3);
+        BenchResult result = { 0, 0, 0, 0 };
+        for(int k=0; k<pdu.size(); k++)
+            pdu.set(k, QSNMPOid() << module->entryOid() << (quint32)(k+1));
+        for(int row=0; row<rows; row++)
+        {
+            for(int k=0; k<pdu.size(); k++)
+                pdu.reset(k);
+            quint64 allocs = allocCalls();
+            timer.restart();
+            if(callHandler(snmpAgent, &reginfo, MODE_GETNEXT, pdu) != SNMP_ERR_NOERROR)
+                result.errors++;
+            result.nsecs += timer.nsecsElapsed();
+            result.allocs += allocCalls() - allocs;
+            result.varbinds += pdu.size();
+        }
+        printResult(out, "table", result);
+    }
+
+    /* SET: PDUs of random Integer32 cells, through the whole SET transaction */
+    {
+        static const int setModes[] = { MODE_SET_RESERVE1, MODE_SET_RESERVE2, MODE_SET_ACTION, MODE_SET_COMMIT };
+        BenchPdu pdu(pduSize);
+        BenchResult result = { 0, 0, 0, 0 };
+        for(int i=0; i<iterations; i++)
+        {
+            for(int k=0; k<pdu.size(); k++)
+            {
+                long value = (long)(benchRandom() % 1000);
+                pdu.set(k, QSNMPOid() << module->entryOid() << 1 << (1 + benchRandom() % rows), ASN_INTEGER, &value, sizeof(value));
+            }
+            quint64 allocs = allocCalls();
+            timer.restart();
+            for(unsigned int m=0; m<sizeof(setModes)/sizeof(setModes[0]); m++)
+            {
+                if(callHandler(snmpAgent, &reginfo, setModes[m], pdu) != SNMP_ERR_NOERROR)
+                    result.errors++;
+            }
+            result.nsecs += timer.nsecsElapsed();
+            result.allocs += allocCalls() - allocs;
+            result.varbinds += pdu.size();
+            for(int k=0; k<pdu.size(); k++)
+            {
+                if(pdu.request(k).status != SNMP_ERR_NOERROR)
+                    result.errors++;
+            }
+        }
+        printResult(out, "set", result);
+    }
+
+    /* Row churn: delete and recreate random row modules, whose variables are recycled by the agent */
+    if(rowModules)
+    {
+        int churns = qMin(iterations, 10*rows);
+        quint64 allocs = allocCalls();
+        timer.restart();
+        for(int i=0; i<churns; i++)
+        {
+            int k = benchRandom() % rows;
+            delete rowModule[k];
+            rowModule[k] = new BenchModule(snmpAgent, groupOid, 0, 1, typed, k+1);
+        }
+        qint64 churnNsecs = timer.nsecsElapsed();
+        qint64 churnPerVar = (liveBytes() - heapBefore) / vars;
+        out << QString("churn        %1 us/row, %2 allocs/row, %3 heap bytes/var after %4 rows\n")
+               .arg(churnNsecs / 1e3 / churns, 0, 'f', 3)
+#ifdef BENCH_COUNT_ALLOCS
+               .arg((double)(allocCalls() - allocs) / churns, 0, 'f', 2)
+               .arg(churnPerVar)
+#else
+               .arg("n/a").arg("n/a")
+#endif
+               .arg(churns);
+        out.flush();
+    }
+
+    /* Delete the module(s), measuring unregistration time */
+    timer.restart();
+    qDeleteAll(rowModule);
+    delete module;
+    qint64 deleteNsecs = timer.nsecsElapsed();
+    out << QString("delete       %1 ms, %2 us/var\n").arg(deleteNsecs / 1e6, 0, 'f', 1).arg(deleteNsecs / 1e3 / vars, 0, 'f', 3);
+    out.flush();
+
+    /* Clean up and exit */
+    delete snmpAgent;
+    return 0;
+}
@@ -21,6 +21,13 @@ MyModule::MyModule(QSNMPAgent * snmpAgent) : QSNMPModule(snmpAgent)
     this->snmpCreateVar("moduleValueB", QSNMPType_Integer, QSNMPMaxAccess_ReadWrite, mMyModuleOid, 3);
     this->snmpCreateVar("moduleValueSum", QSNMPType_Integer, QSNMPMaxAccess_ReadOnly, mMyModuleOid, 4);
 
+    /* Prepare the trap sent on every value change once, with its variable bindings */
+    QSNMPVarList varList;
+    varList << this->snmpVar("moduleValueA");
+    varList << this->snmpVar("moduleValueB");
+    varList << this->snmpVar("moduleValueSum");
+    mSumChangedTrap = new QSNMPTrap(mSnmpAgent, "moduleValueSumChanged", mMyModuleOid, 12, varList);
+
     /* Send a startup done trap (no variable binding) */
     mSnmpAgent->sendTrap("moduleStartupDone", mMyModuleOid, 10);
 }
@@ -34,7 +41,12 @@ MyModule::~MyModule()
     QSNMPVar * var = this->snmpCreateVar("moduleExitMessage", QSNMPType_OctetStr, QSNMPMaxAccess_Notify, mMyModuleOid, 5);
     mSnmpAgent->sendTrap("moduleExiting", mMyModuleOid, 11, var);
 
-    /* No need to delete SNMP variables here because they are automatically freed by QSNMPModule base class destructor. */
+    /* Delete the trap template before its variables */
+    delete mSumChangedTrap;
+
+    /* Unregister and free the SNMP variables before the members they read are destroyed, as the agent may
+     * call this module from its own thread in worker mode (see QSNMPModule::snmpDetach). */
+    this->snmpDetach();
 }
 
 /* Returns the value associated to SNMP variable var (in order to respond to a SNMP GET request). */
@@ -113,11 +125,7 @@ void MyModule::setA(qint32 val)
 
         /* The value changed, which means the sum has changed.
          * Send a trap with some variable bindings. */
-        QSNMPVarList varList;
-        varList << this->snmpVar("moduleValueA");
-        varList << this->snmpVar("moduleValueB");
-        varList << this->snmpVar("moduleValueSum");
-        mSnmpAgent->sendTrap("moduleValueSumChanged", mMyModuleOid, 12, varList);
+        mSumChangedTrap->send();
     }
 }
 
@@ -137,11 +145,7 @@ void MyModule::setB(qint32 val)
 
         /* The value changed, which means the sum has changed.
          * Send a trap with some variable bindings. */
-        QSNMPVarList varList;
-        varList << this->snmpVar("moduleValueA");
-        varList << this->snmpVar("moduleValueB");
-        varList << this->snmpVar("moduleValueSum");
-        mSnmpAgent->sendTrap("moduleValueSumChanged", mMyModuleOid, 12, varList);
+        mSumChangedTrap->send();
     }
 }
 
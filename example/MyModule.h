@@ -30,6 +30,7 @@ private:
     /* Local parameters */
     QSNMPAgent *                mSnmpAgent;
     QSNMPOid                    mMyModuleOid;
+    QSNMPTrap *                 mSumChangedTrap;
 
     /* Dummy values */
     QDateTime                   mStartDateTime;
@@ -26,7 +26,9 @@ MyTableEntry::MyTableEntry(QSNMPAgent * snmpAgent, quint32 index1, quint32 index
 /* MyTableEntry destructor. */
 MyTableEntry::~MyTableEntry()
 {
-    /* No need to delete SNMP variables here because they are automatically freed by QSNMPModule base class destructor. */
+    /* Unregister and free the SNMP variables before the members they read are destroyed, as the agent may
+     * call this module from its own thread in worker mode (see QSNMPModule::snmpDetach). */
+    this->snmpDetach();
 }
 
 /* Returns the value associated to SNMP variable var (in order to respond to a SNMP GET request). */
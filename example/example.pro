@@ -2,6 +2,7 @@
 TARGET  = example
 QT      += core
 QT      -= gui
+CONFIG  += c++14
 
 # NET-SNMP library linkage
 LIBS += -lnetsnmp -lnetsnmpagent